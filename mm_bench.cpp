@@ -0,0 +1,382 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex>
+
+#include "ktiming.h"
+#include "mm_bench.h"
+#include "mm_counters.h"
+#include "mm_dac.h"
+#include "mm_parallel.h"
+
+#define MAX_LIST 64
+
+// columns of our result files, followed by the ones only the harness has
+static const char *csv_header =
+    "course_value,proc_count,matrix_size,schedule_time,working_time,idle_time,elapsed_time,"
+    "variant,backend,type,m,k,n,leaf_size,reps,pack_time,multiply_time,multiply_median,multiply_stddev,"
+    "unpack_time,gflops";
+
+typedef struct {
+    int course_value;       // 1-based index of the variant in the -variants list
+    char variant[32];
+    char backend[32];
+    int workers;
+    int m, k, n;
+    int leaf;
+    int reps;
+    double pack_mean;
+    double mul_mean;
+    double mul_median;
+    double mul_stddev;
+    double unpack_mean;
+    double gflops;
+} bench_result;
+
+typedef struct {
+    double mean;
+    double median;
+    double stddev;
+} bench_stats;
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static bench_stats summarize(const uint64_t *nanos, int count)
+{
+    bench_stats stats = { 0.0, 0.0, 0.0 };
+    double sorted[MAX_LIST];
+    if( count <= 0 ) return stats;
+
+    for( int i = 0; i < count; i++ )
+    {
+        sorted[i] = nanos[i] * 1.0e-9;
+        stats.mean += sorted[i];
+    }
+    stats.mean /= count;
+    qsort( sorted, count, sizeof(double), compare_double );
+    stats.median = count % 2 ? sorted[count / 2] : 0.5 * ( sorted[count / 2 - 1] + sorted[count / 2] );
+    if( count > 1 )
+    {
+        double sq = 0.0;
+        for( int i = 0; i < count; i++ ) sq += ( sorted[i] - stats.mean ) * ( sorted[i] - stats.mean );
+        stats.stddev = sqrt( sq / ( count - 1 ) );
+    }
+    return stats;
+}
+
+// split a comma separated list into out, returning the number of entries
+static int split_list(const char *list, char out[][32], int max)
+{
+    int count = 0;
+    while( list && *list && count < max )
+    {
+        const char *end = strchr( list, ',' );
+        size_t len = end ? (size_t)( end - list ) : strlen( list );
+        if( len > 0 && len < 32 )
+        {
+            memcpy( out[count], list, len );
+            out[count][len] = 0;
+            count++;
+        }
+        list = end ? end + 1 : 0;
+    }
+    return count;
+}
+
+static int parse_size(const char *entry, int *m, int *k, int *n)
+{
+    if( sscanf( entry, "%dx%dx%d", m, k, n ) == 3 ) return *m > 0 && *k > 0 && *n > 0;
+    if( sscanf( entry, "%d", n ) != 1 || *n <= 0 ) return 0;
+    *m = *k = *n;
+    return 1;
+}
+
+// engine settings for a variant name; returns 0 for an unknown name
+static int apply_variant(const char *name, mm_options *options)
+{
+    options->strassen_depth = 0;
+    options->temp_depth = 0;
+    if( !strcmp( name, "classic" ) ) return 1;
+    if( !strncmp( name, "strassen", 8 ) )
+    {
+        options->strassen_depth = name[8] ? atoi( name + 8 ) : 1;
+        return options->strassen_depth > 0;
+    }
+    if( !strncmp( name, "temp", 4 ) )
+    {
+        options->temp_depth = name[4] ? atoi( name + 4 ) : 1;
+        return options->temp_depth > 0;
+    }
+    return 0;
+}
+
+template <typename T>
+static void fill(T *M, size_t count, int salt)
+{
+    mm_parallel_for( 0, count, [&]( size_t i ) {
+        M[i] = T( (int)( ( i * 2654435761u + salt ) % 17 ) - 8 );
+    } );
+}
+
+template <typename T>
+static int bench_one(int m, int k, int n, const bench_options *options, bench_result *result)
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    int reps = options->reps > 0 ? options->reps : 1;
+    if( reps > MAX_LIST ) reps = MAX_LIST;
+    int warmup = options->warmup > 0 ? options->warmup : 0;
+    uint64_t pack[MAX_LIST], mul[MAX_LIST], unpack[MAX_LIST];
+
+    T *A = (T *) mm_alloc( (size_t)m * k * sizeof(T) );
+    T *B = (T *) mm_alloc( (size_t)k * n * sizeof(T) );
+    acc_t *C = (acc_t *) mm_alloc( (size_t)m * n * sizeof(acc_t) );
+    T *a_morton = (T *) mm_alloc_morton( 'A', m, k, sizeof(T) );
+    T *b_morton = (T *) mm_alloc_morton( 'B', k, n, sizeof(T) );
+    acc_t *c_morton = (acc_t *) mm_alloc_morton( 'C', m, n, sizeof(acc_t) );
+    int ok = A && B && C && a_morton && b_morton && c_morton;
+
+    if( ok )
+    {
+        fill( A, (size_t)m * k, 1 );
+        fill( B, (size_t)k * n, 2 );
+
+        counters_reset();
+        for( int rep = -warmup; rep < reps; rep++ )
+        {
+            // counters only run around the timed repetitions
+            int count = rep >= 0 && counters_count() > 0;
+
+            if( count ) counters_start();
+            clockmark_t begin_pack = ktiming_getmark();
+            mm_pack_a( 'N', m, k, A, k, a_morton );
+            mm_pack_b( 'N', k, n, B, n, b_morton );
+            mm_zero( c_morton, mm_morton_size( m, n ) );
+            clockmark_t end_pack = ktiming_getmark();
+            if( count )
+            {
+                counters_stop( COUNT_PACK );
+                counters_start();
+            }
+
+            clockmark_t begin_mul = ktiming_getmark();
+            mm_multiply( m, n, k, a_morton, b_morton, c_morton );
+            clockmark_t end_mul = ktiming_getmark();
+            if( count )
+            {
+                counters_stop( COUNT_MULTIPLY );
+                counters_start();
+            }
+
+            clockmark_t begin_unpack = ktiming_getmark();
+            mm_unpack( m, n, acc_t( 1 ), c_morton, acc_t( 0 ), C, n );
+            clockmark_t end_unpack = ktiming_getmark();
+            if( count ) counters_stop( COUNT_UNPACK );
+
+            if( rep < 0 ) continue;
+            pack[rep] = ktiming_diff_usec( &begin_pack, &end_pack );
+            mul[rep] = ktiming_diff_usec( &begin_mul, &end_mul );
+            unpack[rep] = ktiming_diff_usec( &begin_unpack, &end_unpack );
+        }
+
+        bench_stats mul_stats = summarize( mul, reps );
+        result->pack_mean = summarize( pack, reps ).mean;
+        result->unpack_mean = summarize( unpack, reps ).mean;
+        result->mul_mean = mul_stats.mean;
+        result->mul_median = mul_stats.median;
+        result->mul_stddev = mul_stats.stddev;
+
+        // a complex multiply-add is four real multiplies and four adds
+        double flops = 2.0 * m * n * k;
+        if( mm_types<T>::dtype == MM_COMPLEX64 || mm_types<T>::dtype == MM_COMPLEX128 ) flops *= 4.0;
+        result->gflops = mul_stats.median > 0.0 ? flops / mul_stats.median * 1.0e-9 : 0.0;
+        result->reps = reps;
+
+        printf( "  multiply phase over %d runs:\n", reps );
+        print_runtime_summary( mul, reps );
+        counters_print( reps );
+    }
+
+    mm_free( A );
+    mm_free( B );
+    mm_free( C );
+    mm_free_morton( a_morton );
+    mm_free_morton( b_morton );
+    mm_free_morton( c_morton );
+    return ok ? 0 : -1;
+}
+
+static void write_csv(FILE *file, const bench_result *r, const char *type)
+{
+    // schedule, working and idle time come from the instrumented runtime
+    fprintf( file, "%d,%d,%d,,,,%f,%s,%s,%s,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f",
+             r->course_value, r->workers, r->n, r->mul_mean, r->variant, r->backend, type, r->m, r->k, r->n,
+             r->leaf, r->reps, r->pack_mean, r->mul_mean, r->mul_median, r->mul_stddev, r->unpack_mean, r->gflops );
+    counters_csv_values( file, r->reps );   // per-run averages of the counters
+    fputs( "\n", file );
+}
+
+static void write_json(FILE *file, const bench_result *r, const char *type, int first)
+{
+    fprintf( file, "%s  {\"course_value\": %d, \"proc_count\": %d, \"matrix_size\": %d, "
+                   "\"elapsed_time\": %f, \"variant\": \"%s\", \"backend\": \"%s\", \"type\": \"%s\", \"m\": %d, \"k\": %d, "
+                   "\"n\": %d, \"leaf_size\": %d, \"reps\": %d, \"pack_time\": %f, \"multiply_time\": %f, "
+                   "\"multiply_median\": %f, \"multiply_stddev\": %f, \"unpack_time\": %f, \"gflops\": %f",
+             first ? "" : ",\n", r->course_value, r->workers, r->n, r->mul_mean, r->variant, r->backend, type, r->m,
+             r->k, r->n, r->leaf, r->reps, r->pack_mean, r->mul_mean, r->mul_median, r->mul_stddev,
+             r->unpack_mean, r->gflops );
+    counters_json_values( file, r->reps );
+    fputs( "}", file );
+}
+
+template <typename T>
+static int bench(const char *type, const bench_options *options)
+{
+    char sizes[MAX_LIST][32], workers[MAX_LIST][32], variants[MAX_LIST][32], backends[MAX_LIST][32];
+    int num_sizes = split_list( options->sizes, sizes, MAX_LIST );
+    int num_backends = split_list( options->backends, backends, MAX_LIST );
+    if( !num_backends ) num_backends = split_list( mm_get_backend(), backends, MAX_LIST );
+    int num_workers = split_list( options->workers, workers, MAX_LIST );
+    int num_variants = split_list( options->variants, variants, MAX_LIST );
+    if( !num_variants ) num_variants = split_list( "classic", variants, MAX_LIST );
+
+    FILE *csv = 0, *json = 0;
+    if( options->csv && options->csv[0] )
+    {
+        csv = fopen( options->csv, "a" );
+        if( !csv ) fprintf( stderr, "Could not open %s\n", options->csv );
+        else
+        {
+            fseek( csv, 0, SEEK_END );
+            if( ftell( csv ) == 0 )
+            {
+                fputs( csv_header, csv );
+                counters_csv_header( csv );
+                fputs( "\n", csv );
+            }
+        }
+    }
+    if( options->json && options->json[0] )
+    {
+        json = fopen( options->json, "w" );
+        if( !json ) fprintf( stderr, "Could not open %s\n", options->json );
+        else fputs( "[\n", json );
+    }
+
+    mm_options saved;
+    mm_get_options( &saved );
+    char saved_backend[32];
+    snprintf( saved_backend, sizeof(saved_backend), "%s", mm_get_backend() );
+    int failed = 0, written = 0;
+
+    for( int be = 0; be < num_backends; be++ )
+    {
+        if( mm_set_backend( backends[be] ) )
+        {
+            fprintf( stderr, "Backend %s is not built in (built in: %s)\n", backends[be], mm_backend_names() );
+            failed = 1;
+            continue;
+        }
+        for( int w = 0; w < ( num_workers ? num_workers : 1 ); w++ )
+        {
+            int running = mm_set_workers( num_workers ? atoi( workers[w] ) : 0 );
+            for( int s = 0; s < num_sizes; s++ )
+            {
+                int m, k, n;
+                if( !parse_size( sizes[s], &m, &k, &n ) )
+                {
+                    fprintf( stderr, "Bad size %s\n", sizes[s] );
+                    failed = 1;
+                    continue;
+                }
+                for( int v = 0; v < num_variants; v++ )
+                {
+                    mm_options options_v = saved;
+                    if( !apply_variant( variants[v], &options_v ) )
+                    {
+                        fprintf( stderr, "Unknown variant %s\n", variants[v] );
+                        failed = 1;
+                        continue;
+                    }
+                    options_v.leaf_size = options->leaf > 0 ? options->leaf :
+                                          mm_tuned_leaf_size( mm_types<T>::dtype, m, n, k );
+                    mm_set_options( &options_v );
+                    mm_get_options( &options_v );
+
+                    bench_result result;
+                    memset( &result, 0, sizeof(result) );
+                    result.course_value = v + 1;
+                    strcpy( result.variant, variants[v] );
+                    strcpy( result.backend, backends[be] );
+                    result.workers = running;
+                    result.m = m;
+                    result.k = k;
+                    result.n = n;
+                    result.leaf = options_v.leaf_size;
+
+                    printf( "%s %dx%dx%d, %s, %d workers, %s:\n", type, m, k, n, backends[be], running,
+                            variants[v] );
+                    if( bench_one<T>( m, k, n, options, &result ) )
+                    {
+                        fprintf( stderr, "Out of memory\n" );
+                        failed = 1;
+                        continue;
+                    }
+                    printf( "  pack %f s, multiply median %f s, unpack %f s, %.2f GFLOP/s\n",
+                            result.pack_mean, result.mul_median, result.unpack_mean, result.gflops );
+
+                    if( csv ) write_csv( csv, &result, type );
+                    if( json ) write_json( json, &result, type, !written );
+                    written++;
+                }
+            }
+        }
+    }
+
+    mm_set_options( &saved );
+    mm_set_backend( saved_backend );
+    if( csv ) fclose( csv );
+    if( json )
+    {
+        fputs( "\n]\n", json );
+        fclose( json );
+    }
+    return failed;
+}
+
+int run_bench(const char *type, const bench_options *options)
+{
+    if( !strcmp( type, "double" ) ) return bench<double>( type, options );
+    if( !strcmp( type, "float" ) ) return bench<float>( type, options );
+    if( !strcmp( type, "int8" ) ) return bench<int8_t>( type, options );
+    if( !strcmp( type, "complex64" ) ) return bench< std::complex<float> >( type, options );
+    if( !strcmp( type, "complex128" ) ) return bench< std::complex<double> >( type, options );
+    return -1;
+}
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_BENCH_H_
+#define _MM_BENCH_H_
+
+/*
+ * Benchmark mode of mm_dac: every combination of parallel backend, problem
+ * size, worker count and engine variant is run warmup times untimed and then reps
+ * times with the pack, multiply and unpack phases timed separately.
+ *
+ * backends  comma separated parallel backends (see mm_set_backend); empty
+ *           keeps the current one
+ * sizes     comma separated list of n (square) or MxKxN entries
+ * workers   comma separated worker counts; empty keeps the current one
+ * variants  comma separated engine variants: classic, strassen<depth>,
+ *           temp<depth>
+ * csv/json  files the results are appended to / written to, or empty
+ */
+typedef struct {
+    const char *backends;
+    const char *sizes;
+    const char *workers;
+    const char *variants;
+    int warmup;
+    int reps;
+    int leaf;
+    const char *csv;
+    const char *json;
+} bench_options;
+
+int run_bench(const char *type, const bench_options *options);
+
+#endif  // _MM_BENCH_H_
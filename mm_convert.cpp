@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/*
+ * mm_convert: turn a row-major matrix stored as raw binary or CSV into a
+ * Morton file (see mm_packed_save), so repeat jobs can map their operands
+ * with mm_packed_map instead of packing them on every run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex>
+
+#include "getoptions.h"
+#include "mm_dac.h"
+
+const char *specifiers[] = {"-in", "-out", "-rows", "-cols", "-side", "-type", "-leaf", "-csv", "-trans",
+                            "-check", "-h", 0};
+int opt_types[] = {STRINGARG, STRINGARG, INTARG, INTARG, STRINGARG, STRINGARG, INTARG, BOOLARG, BOOLARG,
+                   STRINGARG, BOOLARG, 0};
+
+int usage(void) {
+  fprintf(stderr,
+      "\nUsage: mm_convert -in file -out file -rows # -cols # [-side A|B]\n"
+      "                  [-type double|float|int8|complex64|complex128]\n"
+      "                  [-leaf #] [-csv] [-trans]\n"
+      "       mm_convert -check file\n\n"
+      "Packs the rows x cols matrix in -in into a Morton file for use as the\n"
+      "A (default) or B operand, with leaf tiles of -leaf (default %d) elements.\n"
+      "-in holds rows * cols elements of -type (default double) in row-major\n"
+      "order, or its transpose with -trans; with -csv it is text, one row per\n"
+      "line, and complex elements are given as real and imaginary part.\n"
+      "-check maps a Morton file, verifies its checksum and prints its header.\n",
+      MM_DEFAULT_LEAF_SIZE);
+  return 1;
+}
+
+static int parse_elem(char **cursor, double *value) {
+    char *end;
+    // separators between values: commas, semicolons and whitespace
+    *cursor += strspn(*cursor, ",; \t\r\n");
+    *value = strtod(*cursor, &end);
+    if(end == *cursor) return -1;
+    *cursor = end;
+    return 0;
+}
+
+template <typename T> static int parse_csv(char **cursor, T *elem) {
+    double value;
+    if(parse_elem(cursor, &value)) return -1;
+    *elem = (T) value;
+    return 0;
+}
+template <> int parse_csv<int8_t>(char **cursor, int8_t *elem) {
+    double value;
+    if(parse_elem(cursor, &value) || value < -128 || value > 127) return -1;
+    *elem = (int8_t) value;
+    return 0;
+}
+template <> int parse_csv< std::complex<float> >(char **cursor, std::complex<float> *elem) {
+    double re, im;
+    if(parse_elem(cursor, &re) || parse_elem(cursor, &im)) return -1;
+    *elem = std::complex<float>((float) re, (float) im);
+    return 0;
+}
+template <> int parse_csv< std::complex<double> >(char **cursor, std::complex<double> *elem) {
+    double re, im;
+    if(parse_elem(cursor, &re) || parse_elem(cursor, &im)) return -1;
+    *elem = std::complex<double>(re, im);
+    return 0;
+}
+
+// the whole of path as a 0-terminated string
+static char *read_text(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = size >= 0 ? (char *) malloc(size + 1) : 0;
+    if(text) {
+        size_t got = fread(text, 1, size, file);
+        text[got] = 0;
+    }
+    fclose(file);
+    return text;
+}
+
+template <typename T>
+int convert(const char *in, const char *out, int rows, int cols, char side, int csv, int trans) {
+    size_t count = (size_t) rows * cols;
+    T *M = (T *) malloc(count * sizeof(T));
+    if(!M) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int failed = 0;
+    if(csv) {
+        char *text = read_text(in);
+        char *cursor = text;
+        for(size_t i = 0; text && i < count && !failed; i++)
+            failed = parse_csv(&cursor, &M[i]);
+        if(text && !failed) failed = cursor[strspn(cursor, ",; \t\r\n")] != 0;
+        if(!text || failed) fprintf(stderr, "%s does not hold exactly %zu values\n", in, count);
+        failed = !text || failed;
+        free(text);
+    }
+    else {
+        FILE *file = fopen(in, "rb");
+        failed = !file || fread(M, sizeof(T), count, file) != count || fgetc(file) != EOF;
+        if(file) fclose(file);
+        if(failed) fprintf(stderr, "%s does not hold exactly %zu elements\n", in, count);
+    }
+
+    mm_packed *packed = 0;
+    if(!failed) {
+        packed = mm_pack<T>(side, trans ? 'T' : 'N', rows, cols, M, trans ? rows : cols);
+        failed = !packed || mm_packed_save(packed, out);
+        if(failed) fprintf(stderr, "Could not write %s\n", out);
+    }
+    mm_packed_free(packed);
+    free(M);
+    return failed;
+}
+
+static int check(const char *path) {
+    mm_packed *packed = mm_packed_map(path, 1);
+    if(!packed) {
+        fprintf(stderr, "%s is not a valid Morton file\n", path);
+        return 1;
+    }
+    char side;
+    mm_dtype dtype;
+    int rows, cols, leaf;
+    mm_packed_info(packed, &side, &dtype, &rows, &cols, &leaf);
+    printf("%s: %s %d x %d, side %c, leaf size %d, checksum ok\n", path, mm_dtype_name(dtype), rows, cols,
+           side, leaf);
+    mm_packed_free(packed);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    char in[256] = "";
+    char out[256] = "";
+    int rows = 0;
+    int cols = 0;
+    char side_opt[32] = "A";
+    char type_opt[32] = "double";
+    int leaf = 0;
+    int csv = 0;
+    int trans = 0;
+    char check_opt[256] = "";
+    int help = 0;
+
+    get_options(argc, argv, specifiers, opt_types, in, out, &rows, &cols, side_opt, type_opt, &leaf, &csv,
+                &trans, check_opt, &help);
+    if (help || argc == 1) return usage();
+    if (check_opt[0]) return check(check_opt);
+
+    char side = side_opt[0] == 'b' || side_opt[0] == 'B' ? 'B' : 'A';
+    if (!in[0] || !out[0] || rows <= 0 || cols <= 0 || side_opt[1]) return usage();
+
+    mm_options options;
+    mm_get_options(&options);
+    options.leaf_size = leaf;
+    mm_set_options(&options);
+
+    int result;
+    if (!strcmp(type_opt, "double")) result = convert<double>(in, out, rows, cols, side, csv, trans);
+    else if (!strcmp(type_opt, "float")) result = convert<float>(in, out, rows, cols, side, csv, trans);
+    else if (!strcmp(type_opt, "int8")) result = convert<int8_t>(in, out, rows, cols, side, csv, trans);
+    else if (!strcmp(type_opt, "complex64")) result = convert< std::complex<float> >(in, out, rows, cols, side, csv, trans);
+    else if (!strcmp(type_opt, "complex128")) result = convert< std::complex<double> >(in, out, rows, cols, side, csv, trans);
+    else return usage();
+
+    if (!result) check(out);
+    return result;
+}
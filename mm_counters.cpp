@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include "mm_counters.h"
+
+#ifdef MM_USE_PAPI
+
+#include <papi.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 16
+#define MAX_SETS 1024
+
+static const char *phase_names[COUNT_PHASES] = { "pack", "multiply", "unpack" };
+
+static int event_sets[MAX_SETS];
+static int num_sets = 0;
+static int num_events = 0;
+static char event_names[MAX_EVENTS][PAPI_MAX_STR_LEN];
+static long long totals[COUNT_PHASES][MAX_EVENTS];
+
+// event set for one CPU, or for the calling thread when cpu < 0
+static int create_set(int cpu, char names[][PAPI_MAX_STR_LEN], int count)
+{
+    int set = PAPI_NULL;
+    if( PAPI_create_eventset( &set ) != PAPI_OK ) return PAPI_NULL;
+
+    if( cpu >= 0 )
+    {
+        PAPI_option_t option;
+        memset( &option, 0, sizeof(option) );
+        option.cpu.eventset = set;
+        option.cpu.cpu_num = cpu;
+        if( PAPI_assign_eventset_component( set, 0 ) != PAPI_OK ||
+            PAPI_set_opt( PAPI_CPU_ATTACH, &option ) != PAPI_OK )
+        {
+            PAPI_destroy_eventset( &set );
+            return PAPI_NULL;
+        }
+    }
+
+    for( int e = 0; e < count; e++ )
+    {
+        if( PAPI_add_named_event( set, names[e] ) != PAPI_OK )
+        {
+            PAPI_cleanup_eventset( set );
+            PAPI_destroy_eventset( &set );
+            return PAPI_NULL;
+        }
+    }
+    return set;
+}
+
+int counters_init(const char *events, int per_cpu)
+{
+    char requested[MAX_EVENTS][PAPI_MAX_STR_LEN];
+    int count = 0;
+
+    if( PAPI_library_init( PAPI_VER_CURRENT ) != PAPI_VER_CURRENT ) return -1;
+    PAPI_thread_init( (unsigned long (*)(void)) pthread_self );
+
+    // keep the events this machine can count, in the order given
+    while( events && *events && count < MAX_EVENTS )
+    {
+        const char *end = strchr( events, ',' );
+        size_t len = end ? (size_t)( end - events ) : strlen( events );
+        if( len > 0 && len < PAPI_MAX_STR_LEN )
+        {
+            memcpy( requested[count], events, len );
+            requested[count][len] = 0;
+
+            int probe = create_set( -1, &requested[count], 1 );
+            if( probe != PAPI_NULL )
+            {
+                PAPI_cleanup_eventset( probe );
+                PAPI_destroy_eventset( &probe );
+                count++;
+            }
+            else
+                fprintf( stderr, "Cannot count %s\n", requested[count] );
+        }
+        events = end ? end + 1 : 0;
+    }
+    if( !count ) return 0;
+
+    if( per_cpu )
+    {
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        for( int cpu = 0; cpu < cpus && cpu < MAX_SETS; cpu++ )
+        {
+            int set = create_set( cpu, requested, count );
+            if( set == PAPI_NULL )
+            {
+                fprintf( stderr, "Cannot attach counters to CPU %d, counting this thread only\n", cpu );
+                while( num_sets > 0 )
+                {
+                    PAPI_cleanup_eventset( event_sets[--num_sets] );
+                    PAPI_destroy_eventset( &event_sets[num_sets] );
+                }
+                break;
+            }
+            event_sets[num_sets++] = set;
+        }
+    }
+    if( !num_sets )
+    {
+        int set = create_set( -1, requested, count );
+        if( set == PAPI_NULL ) return -1;
+        event_sets[num_sets++] = set;
+    }
+
+    memcpy( event_names, requested, sizeof(requested) );
+    num_events = count;
+    counters_reset();
+    return count;
+}
+
+void counters_start(void)
+{
+    for( int s = 0; s < num_sets; s++ ) PAPI_start( event_sets[s] );
+}
+
+void counters_stop(int phase)
+{
+    long long values[MAX_EVENTS];
+
+    // the sum over the per-CPU sets is the count over all workers
+    for( int s = 0; s < num_sets; s++ )
+    {
+        if( PAPI_stop( event_sets[s], values ) != PAPI_OK ) continue;
+        for( int e = 0; e < num_events; e++ ) totals[phase][e] += values[e];
+    }
+}
+
+void counters_reset(void)
+{
+    memset( totals, 0, sizeof(totals) );
+}
+
+int counters_count(void)
+{
+    return num_events;
+}
+
+void counters_print(int runs)
+{
+    if( runs < 1 ) runs = 1;
+    for( int p = 0; p < COUNT_PHASES; p++ )
+        for( int e = 0; e < num_events; e++ )
+            printf( "  %s %s: %lld\n", phase_names[p], event_names[e], totals[p][e] / runs );
+}
+
+void counters_csv_header(FILE *file)
+{
+    for( int p = 0; p < COUNT_PHASES; p++ )
+        for( int e = 0; e < num_events; e++ )
+            fprintf( file, ",%s:%s", phase_names[p], event_names[e] );
+}
+
+void counters_csv_values(FILE *file, int runs)
+{
+    if( runs < 1 ) runs = 1;
+    for( int p = 0; p < COUNT_PHASES; p++ )
+        for( int e = 0; e < num_events; e++ )
+            fprintf( file, ",%lld", totals[p][e] / runs );
+}
+
+void counters_json_values(FILE *file, int runs)
+{
+    if( runs < 1 ) runs = 1;
+    for( int p = 0; p < COUNT_PHASES; p++ )
+        for( int e = 0; e < num_events; e++ )
+            fprintf( file, ", \"%s:%s\": %lld", phase_names[p], event_names[e], totals[p][e] / runs );
+}
+
+void counters_finish(void)
+{
+    while( num_sets > 0 )
+    {
+        num_sets--;
+        PAPI_cleanup_eventset( event_sets[num_sets] );
+        PAPI_destroy_eventset( &event_sets[num_sets] );
+    }
+    num_events = 0;
+    PAPI_shutdown();
+}
+
+#endif  // MM_USE_PAPI
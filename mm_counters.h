@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_COUNTERS_H_
+#define _MM_COUNTERS_H_
+
+#include <stdio.h>
+
+/*
+ * Hardware counters around the pack, multiply and unpack phases of
+ * mm_dac, read with PAPI.  Only built with -DMM_USE_PAPI (make PAPI=1);
+ * otherwise every call below is an empty inline function and nothing of
+ * PAPI is compiled or linked.
+ *
+ * counters_init takes a comma separated list of PAPI preset or native
+ * event names and returns how many could be added, or -1 if PAPI failed
+ * to start or is not built in.  With per_cpu
+ * every online CPU gets its own event set attached to it, so the counts
+ * cover all workers wherever they run (and anything else on those CPUs);
+ * without it, or when attaching is not permitted, only the calling thread
+ * is counted.  counters_stop adds the counts since counters_start to the
+ * given phase.
+ */
+enum { COUNT_PACK, COUNT_MULTIPLY, COUNT_UNPACK, COUNT_PHASES };
+
+#ifdef MM_USE_PAPI
+
+int counters_init(const char *events, int per_cpu);
+void counters_start(void);
+void counters_stop(int phase);
+void counters_reset(void);
+int counters_count(void);
+void counters_print(int runs);
+void counters_csv_header(FILE *file);
+void counters_csv_values(FILE *file, int runs);
+void counters_json_values(FILE *file, int runs);
+void counters_finish(void);
+
+#else
+
+static inline int counters_init(const char *, int) { return -1; }
+static inline void counters_start(void) {}
+static inline void counters_stop(int) {}
+static inline void counters_reset(void) {}
+static inline int counters_count(void) { return 0; }
+static inline void counters_print(int) {}
+static inline void counters_csv_header(FILE *) {}
+static inline void counters_csv_values(FILE *, int) {}
+static inline void counters_json_values(FILE *, int) {}
+static inline void counters_finish(void) {}
+
+#endif  // MM_USE_PAPI
+
+#endif  // _MM_COUNTERS_H_
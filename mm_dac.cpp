@@ -20,22 +20,13 @@
  * IN THE SOFTWARE.
  **/
 
-// This switch allows for the quick and easy switching between the serial eliason and the
-// parallel implementation with cilk runtime.
-#if 1
-#include <cilk/cilk.h>
-#include <cilk/cilk_api.h>
-#else
-#define cilk_spawn 
-#define cilk_sync
-#endif
-
 #include <numa.h>
 
 // This controls the debug infrastructure added to the code base. The debugPrintf and
 // print_mm macros are utilized to support the easy enable/disable of debug
 // infrastructure.
-#if 0
+#define DEBUG_PRINT 0
+#if DEBUG_PRINT
 #define debugPrintf printf
 #define print_mm print_matrix
 #else
@@ -46,400 +37,674 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <complex>
 
 #include "getoptions.h"
 #include "ktiming.h"
-#include "papi.h"
-
-#ifndef RAND_MAX
-#define RAND_MAX 32767
-#endif
-
-#define REAL double 
-
-#define EPSILON (1.0E-6)
-#define BASE_BLOCK_SIZE 8
-#define Z_WIDTH 16
-
-unsigned long rand_nxt = 0;
-
-int cilk_rand(void) {
-    int result;
-    rand_nxt = rand_nxt * 1103515245 + 12345;
-    result = (rand_nxt >> 16) % ((unsigned int) RAND_MAX + 1);
-    return result;
-}
-
-/*
- * Naive sequential algorithm, for comparison purposes
- */
-void matrixmul(REAL *C, REAL *A, REAL *B, int n) {
-
-  for(int i = 0; i < n; ++i) {
-    for(int j = 0; j < n; ++j) {
-      REAL s = (REAL)0;
-      for(int k = 0; k < n; ++k) {
-        s += A[i*n+k] * B[k*n+j];
-      }
-      C[i*n+j] = s;
-    }
-  }
-}
-
-void print_matrix( REAL *A, int n, int orig_n )
+#include "mm_bench.h"
+#include "mm_counters.h"
+#include "mm_dac.h"
+#include "mm_packed.h"
+#include "mm_server.h"
+
+#if DEBUG_PRINT
+static void print_elem( double x ) { printf("%16.2f ", x); }
+static void print_elem( std::complex<double> x ) { printf("%8.2f%+8.2fi ", x.real(), x.imag()); }
+
+template <typename U>
+void print_matrix( U *A, int rows, int cols, int ld )
 {
-    for (int i = 0; i < n; ++i )
+    for (int i = 0; i < rows; ++i )
     {
-        for( int j = 0; j < n; ++j )
+        for( int j = 0; j < cols; ++j )
         {
-            printf("%16.2f ", A[i * orig_n + j]);
+            print_elem( A[i * ld + j] );
         }
         printf("\n");
     }
 }
+#endif
 
-void mm_base( REAL *C, REAL *A, REAL *B, int block_size, int original_size )
-{
-    REAL s = (REAL)0;
-    int a_index = 0;
-    int b_index = 0;
+const char *specifiers[] = {"-n", "-m", "-k", "-c", "-h", "-kernel", "-type", "-strassen", "-leaf", "-tune", "-grain", "-temp", "-numa", "-nodes", "-huge", "-prefault",
+                            "-verify", "-trials", "-rtol", "-atol", "-bench", "-sizes", "-workers",
+                            "-variants", "-warmup", "-reps", "-csv", "-json", "-events", "-percpu", "-ooc", "-a", "-b", "-seed", "-direct",
+                            "-serve", "-client", "-jobs", "-clients", "-cacheb", "-stop",
+                            "-backend", "-backends", "-mixed", "-batch", "-sparse", 0};
+int opt_types[] = {INTARG, INTARG, INTARG, BOOLARG, BOOLARG, STRINGARG, STRINGARG, INTARG, INTARG, BOOLARG, INTARG, INTARG, STRINGARG, INTARG, STRINGARG, BOOLARG,
+                 STRINGARG, INTARG, DOUBLEARG, DOUBLEARG, BOOLARG, STRINGARG, STRINGARG,
+                 STRINGARG, INTARG, INTARG, STRINGARG, STRINGARG, STRINGARG, BOOLARG, INTARG, STRINGARG, STRINGARG, INTARG, BOOLARG,
+                 STRINGARG, STRINGARG, INTARG, INTARG, BOOLARG, BOOLARG,
+                 STRINGARG, STRINGARG, STRINGARG, INTARG, INTARG, 0};
 
-    
-    debugPrintf("\n\nmm_base; a_addr=0x%08x, b_addr=0x%08x\n", A, B);
+int usage(void) {
+  fprintf(stderr, 
+      "\nUsage: mm_dac [-n #] [-m #] [-k #] [-c] [-kernel scalar|avx2|avx512]\n"
+      "              [-type double|float|int8|complex64|complex128] [-strassen #]\n"
+      "              [-leaf #] [-tune] [-grain #] [-temp #]\n"
+      "              [-numa default|interleave|first-touch|partitioned] [-nodes #]\n"
+      "              [-huge none|transparent|explicit] [-prefault]\n"
+      "              [-verify auto|freivalds|exact] [-trials #] [-rtol #] [-atol #]\n"
+      "              [-ooc #] [-a file] [-b file] [-seed #] [-direct]\n"
+      "              [-backend cilk|openmp|threads|serial] [-workers #]\n"
+      "              [-mixed float|refine] [-batch #] [-sparse #]\n"
+      "       mm_dac -bench [-sizes n,MxKxN,...] [-workers #,...]\n"
+      "              [-backends cilk,openmp,threads,serial]\n"
+      "              [-variants classic,strassen#,temp#,...] [-warmup #] [-reps #]\n"
+      "              [-csv file] [-json file] [-type ...] [-leaf #]\n"
+      "       mm_dac -serve socket [-leaf #] [-strassen #] ...\n"
+      "       mm_dac -client socket [-jobs #] [-clients #] [-cacheb] [-stop]\n"
+      "              [-n #] [-m #] [-k #] [-type ...] [-seed #] [-c]\n"
+      "       either with [-events name,...] [-percpu] when built with PAPI=1\n\n"
+      "Multiplies a randomly generated m x k matrix by a k x n one; m and k\n"
+      "default to n, and none of them need to be a power of two. To check for\n"
+      "correctness use -c. The leaf kernel is picked from the host CPU\n"
+      "unless -kernel forces one. -type sets the element type (default\n"
+      "double); int8 operands accumulate into int32. -strassen # runs the\n"
+      "top # recursion levels as Strassen-Winograd. -leaf # sets the leaf\n"
+      "tile width; otherwise it is read from " MM_TUNE_FILE ", which -tune\n"
+      "fills by timing the candidate widths for this type and size first.\n"
+      "-grain # sets the size below which the recursion stops spawning.\n"
+      "-temp # runs the top # levels with a temporary buffer and one sync.\n"
+      "-numa picks the page placement of the Morton buffers over -nodes #\n"
+      "NUMA nodes (default all); without it, more than 8 workers interleave.\n"
+      "-huge sets the page size of the buffers (default transparent huge\n"
+      "pages) and -prefault touches their pages before the timed phases.\n"
+      "-c checks with Freivalds' test (-trials random vectors, default 8)\n"
+      "or, for small problems or -verify exact, against a full parallel\n"
+      "recomputation; elements may differ by -atol + -rtol * sum |a||b|.\n"
+      "-ooc # multiplies out of core: the Morton buffers are written to files\n"
+      "in $TMPDIR and streamed through a memory budget of # MiB.\n"
+      "A and B are random integers from -seed # (default 0), the same for any\n"
+      "worker count; -direct writes them straight into Morton order and skips\n"
+      "the pack pass.\n"
+      "-a and -b map A and B from Morton files written by mm_convert instead\n"
+      "of generating and packing them; their shapes, type and leaf size win.\n"
+      "-backend picks the parallel runtime of the built-in ones and -workers\n"
+      "sets its number of workers.\n"
+      "-mixed runs the double multiply once in double and once with float\n"
+      "operands accumulated in double, refined or not, on fractions in [-1, 1)\n"
+      "that float cannot hold exactly, and reports both times and the normwise\n"
+      "error max|C - R| / max|R| of the mixed result C against the double one\n"
+      "R; with -c that error must be within EPSILON.\n"
+      "-batch # runs # independent m x k x n multiplies as one batch instead,\n"
+      "and -c checks each of them.\n"
+      "-sparse # zeroes A and B outside # diagonal blocks, so the multiply\n"
+      "skips the all-zero quadrants.\n"
+      "-bench runs every backend, size, worker count and variant -warmup times\n"
+      "(default 1) and then -reps times (default 5), and reports each phase\n"
+      "with GFLOP/s, appending rows to -csv in the columns of our result files\n"
+      "and writing them to -json.\n"
+      "-serve keeps the workers, buffers and cached packed B operands warm\n"
+      "and runs the multiplies clients send to the Unix socket, on operands\n"
+      "in shared memory, until a client sends -stop. -client runs -clients\n"
+      "connections (default 1) of -jobs multiplies each (default 100) and\n"
+      "reports job rate and latency percentiles, its own and the server's;\n"
+      "-cacheb keeps each client's B packed on the server and -c checks\n"
+      "the last result of every client.\n"
+      "-events counts the given PAPI events (e.g. PAPI_L1_DCM,PAPI_L3_TCM,\n"
+      "PAPI_RES_STL) in each phase, summed over all CPUs with -percpu.\n");
+  return 1;
+}
 
-    for( int i = 0; i < block_size; ++i )
-    {
-        // a_index = i * original_size;
-        for( int j = 0; j < block_size; ++j )
-        {
-            s = (REAL)0;
-            b_index = 0;
-            for( int k = 0; k < block_size; ++k )
-            {
-                debugPrintf("%f * %f\n", A[ a_index + k ],B[ b_index + j ]);
-                s += A[ a_index + k ] * B[ b_index + j ];
-                b_index += original_size;
-            }
-            C[a_index + j] += s;
-        }
-        a_index += original_size;
-    }
+// Morton buffers of the out-of-core mode are staged through files
+static void ooc_path(char *path, size_t size, char side) {
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/mm_dac.%d.%c", dir && dir[0] ? dir : "/tmp", (int) getpid(), side);
 }
 
-void mm_morton_base( REAL *C, REAL *A, REAL *B, int block_size, int original_size )
-{
-    int a_index = 0;
-    int b_index = 0;
-    REAL s = 0;
+static int write_file(const char *path, const void *data, size_t bytes) {
+    FILE *file = fopen(path, "wb");
+    if(!file) return -1;
+    size_t written = fwrite(data, 1, bytes, file);
+    return fclose(file) == 0 && written == bytes ? 0 : -1;
+}
 
-    // for every row in matrix A
-    for( int i = 0; i < block_size; ++i )
-    {
-        // for each column in matrix B
-        b_index = 0;
-        for( int j = 0; j < block_size; ++j )
-        {
-            s = (REAL)0;
-            for( int k = 0; k < block_size; ++k )
-            {
-                debugPrintf("%f * %f\n", A[ a_index + k ], B[ b_index + k ]);
-                s += A[ a_index + k ] * B[ b_index + k ];
-            }
-            C[a_index + j] += s;
-            b_index += block_size;
-        }
-        a_index += block_size;
-    }
+static int read_file(const char *path, void *data, size_t bytes) {
+    FILE *file = fopen(path, "rb");
+    if(!file) return -1;
+    size_t read = fread(data, 1, bytes, file);
+    fclose(file);
+    return read == bytes ? 0 : -1;
+}
 
-    debugPrintf("\n\nmm_morton_base: c=0x%08x, block_size=%d\n", C, block_size);
-    print_mm( C, block_size, block_size);
+// how -c checks the result, see mm_verify
+typedef struct {
+    int mode;
+    int trials;
+    double rtol;
+    double atol;
+} check_options;
+
+// where A and B come from: Morton files mapped with -a / -b, else generated from seed
+typedef struct {
+    const char *a_path;
+    const char *b_path;
+    mm_packed *a;
+    mm_packed *b;
+    int seed;
+    int direct;     // generate straight into the Morton buffers
+    int sparse;     // keep only this many diagonal blocks of A and B, 0 for all
+} input_files;
+
+// -sparse: zero M outside blocks diagonal blocks, which keeps A * B block diagonal
+template <typename T>
+static void keep_diagonal_blocks(T *M, int rows, int cols, int blocks) {
+    for(int i = 0; i < rows; i++)
+        for(int j = 0; j < cols; j++)
+            if((long)i * blocks / rows != (long)j * blocks / cols) M[(size_t)i * cols + j] = T(0);
 }
 
+// largest normwise error -c accepts from a -mixed result
+#define EPSILON (1.0E-6)
+
 /*
- * Compare two matrices.  Print an error message if they differ by
- * more than EPSILON.
- * return 0 if no error, and return non-zero if error.
+ * Fills the rows x cols matrix M with fractions in [-1, 1) of 30 significant
+ * bits from two integer draws, so unlike mm_random's integers they are not
+ * exact in float.  Returns -1 when out of memory.
  */
-static int compare_matrix(REAL *A, REAL *B, int n) {
-
-  for (int i = 0; i < n; ++i) {
-    for (int j = 0; j < n; ++j) {
-      // compute the relative error c 
-      REAL c = A[n*i + j] - B[n*i + j];
-      if (c < 0.0) c = -c;
-
-      c = c / A[n*i + j];
-      if (c > EPSILON) { 
-        return -1; 
-      }
-    }
-  }
-  return 0;
+static int random_fraction(int seed, int rows, int cols, double *M) {
+    double *low = (double *) mm_alloc((size_t)rows * cols * sizeof(double));
+    if(!low) return -1;
+    mm_random(seed, rows, cols, M, cols);
+    mm_random(seed + 1000003, rows, cols, low, cols);
+    for(size_t i = 0; i < (size_t)rows * cols; i++)
+        M[i] = ldexp(M[i] * 32768.0 + low[i], -29) - 1.0;
+    mm_free(low);
+    return 0;
 }
 
-//init the matrix to all zeros 
-void zero(REAL *M, int n){
-    int i;
-    for(i = 0; i < n * n; i++) {
-        M[i] = 0.0;
+/*
+ * -mixed: the same double multiply through mm_dgemm and mm_dgemm_mixed,
+ * timed, and the normwise error max|C - R| / max|R| of the mixed result C
+ * against the double one R.
+ */
+static int run_mixed(int m, int n, int k, int mode, int verify, int leaf, int seed) {
+    double *A = (double *) mm_alloc((size_t)m * k * sizeof(double));
+    double *B = (double *) mm_alloc((size_t)k * n * sizeof(double));
+    double *C = (double *) mm_alloc((size_t)m * n * sizeof(double));
+    double *R = (double *) mm_alloc((size_t)m * n * sizeof(double));
+    if(!A || !B || !C || !R) {
+        fprintf(stderr, "Out of memory\n");
+        mm_free(A);
+        mm_free(B);
+        mm_free(C);
+        mm_free(R);
+        return 1;
     }
-}
 
-//init the matrix to random numbers
-void init(REAL *M, int n){
-    int i,j;
-    for(i = 0; i < n; i++) {
-        for(j = 0; j < n; j++){
-            M[i*n+j] = (REAL) cilk_rand();
-        }
+    //without -leaf each precision takes its own tuned leaf size
+    if(leaf > 0) {
+        mm_options options;
+        mm_get_options(&options);
+        options.leaf_size = leaf;
+        mm_set_options(&options);
     }
-}
-
-//recursive parallel solution to matrix multiplication - row major order
-void mat_mul_par(REAL *A, REAL *B, REAL *C, int n, int orig_n) {
-
-    if(n <= BASE_BLOCK_SIZE) {
-        mm_morton_base( C, A, B, n, orig_n );
-        // mm_base( C, A, B, n, orig_n );
-        return;
+    printf("Leaf size: double %d, mixed %d\n", leaf > 0 ? leaf : mm_tuned_leaf_size(MM_FLOAT64, m, n, k),
+           leaf > 0 ? leaf : mm_tuned_leaf_size(MM_FLOAT32, m, n, k));
+    printf("Parallel backend: %s\n", mm_get_backend());
+    printf("numWorkers=%d\n", mm_get_workers());
+    printf("Mixed precision: %s\n", mode == MM_MIXED_REFINE ? "float, refined" : "float");
+
+    if(random_fraction(seed, m, k, A) || random_fraction(seed + 1, k, n, B)) {
+        fprintf(stderr, "Out of memory\n");
+        mm_free(A);
+        mm_free(B);
+        mm_free(C);
+        mm_free(R);
+        return 1;
     }
 
-    int sub_block_length = n * n;
-    int half = sub_block_length >> 1;
-    int fourth = sub_block_length >> 2;
-
-    //partition each matrix into 4 sub matrices
-    //each sub-matrix points to the start of the z pattern
-    REAL *A1 = &A[0];
-    REAL *A2 = &A[fourth];
-    REAL *A3 = &A[half];
-    REAL *A4 = &A3[fourth];
-
-    REAL *B1 = &B[0];
-    REAL *B2 = &B[half];
-    REAL *B3 = &B[fourth];
-    REAL *B4 = &B2[fourth];
-
-    REAL *C1 = &C[0];
-    REAL *C2 = &C[fourth];
-    REAL *C3 = &C[half];
-    REAL *C4 = &C3[fourth];
-
-    //recrusively call the sub-matrices for evaluation in parallel
-    cilk_spawn mat_mul_par(A1, B1, C1, n >> 1, orig_n);
-    cilk_spawn mat_mul_par(A1, B2, C2, n >> 1, orig_n);
-    cilk_spawn mat_mul_par(A3, B1, C3, n >> 1, orig_n);
-    mat_mul_par(A3, B2, C4, n >> 1, orig_n);
-    cilk_sync; //wait here for first round to finish
-
-    cilk_spawn mat_mul_par(A2, B3, C1, n >> 1, orig_n);
-    cilk_spawn mat_mul_par(A2, B4, C2, n >> 1, orig_n);
-    cilk_spawn mat_mul_par(A4, B3, C3, n >> 1, orig_n);
-    mat_mul_par(A4, B4, C4, n >> 1, orig_n);
-    cilk_sync; //wait here for all second round to finish
-}
-
-void transformMatrixA( REAL *src, REAL *z_dest, int z_dest_size, int row_index, int col_index, int matrix_width, int src_original_n )
-{
-    if( matrix_width == BASE_BLOCK_SIZE )
-    {
-        // reached base case
-        int row_idx = 0;
-        int col_idx = 0;
-        int z_idx = 0;
-        int calc_col_idx = 0;
-        int calc_row_idx = 0;
-
-        for( row_idx = 0; row_idx < BASE_BLOCK_SIZE; row_idx++ )
-        {
-            calc_row_idx = row_index + row_idx;
-            for( col_idx = 0; col_idx < BASE_BLOCK_SIZE; col_idx++ )
-            {
-                
-                calc_col_idx = col_index + col_idx;
-                z_dest[z_idx++] = src[(calc_row_idx * src_original_n) + calc_col_idx];
-            }
-        }
-        return;
+    clockmark_t begin_double = ktiming_getmark();
+    int failed = mm_dgemm('N', 'N', m, n, k, 1.0, A, k, B, n, 0.0, R, n);
+    clockmark_t end_double = ktiming_getmark();
+    clockmark_t begin_mixed = ktiming_getmark();
+    failed |= mm_dgemm_mixed('N', 'N', m, n, k, 1.0, A, k, B, n, 0.0, C, n, mode);
+    clockmark_t end_mixed = ktiming_getmark();
+
+    double error = 0.0, largest = 0.0;
+    for(size_t i = 0; i < (size_t)m * n; i++) {
+        if(fabs(C[i] - R[i]) > error) error = fabs(C[i] - R[i]);
+        if(fabs(R[i]) > largest) largest = fabs(R[i]);
     }
-
-    // compute new location within the morton z buffer
-    int fourth_size = z_dest_size >> 2;
-    REAL *top_left     = z_dest;
-    REAL *top_right    = z_dest + (fourth_size);
-    REAL *bottom_left  = z_dest + (z_dest_size >> 1);
-    REAL *bottom_right = z_dest + 3 * (fourth_size);
-
-    // recursively sub-partition the matrix until the base case is reached
-    transformMatrixA( src, top_left,     fourth_size, row_index, col_index,                                             matrix_width >> 1, src_original_n );
-    transformMatrixA( src, top_right,    fourth_size, row_index, col_index + (matrix_width >> 1),                       matrix_width >> 1, src_original_n );
-    transformMatrixA( src, bottom_left,  fourth_size, row_index + (matrix_width >> 1), col_index,                       matrix_width >> 1, src_original_n );
-    transformMatrixA( src, bottom_right, fourth_size, row_index + (matrix_width >> 1), col_index + (matrix_width >> 1), matrix_width >> 1, src_original_n );
-}
-
-void transformMatrixB( REAL *src, REAL *z_dest, int z_dest_size, int row_index, int col_index, int matrix_width, int src_original_n )
-{
-    if( matrix_width == BASE_BLOCK_SIZE )
-    {
-
-        // reached base case
-        int row_idx = 0;
-        int col_idx = 0;
-        int z_idx = 0;
-        int calc_col_idx = 0;
-        int calc_row_idx = 0;
-
-        for( col_idx = 0; col_idx < BASE_BLOCK_SIZE; col_idx++ )
-        {
-            calc_col_idx = col_index + col_idx;
-            for( row_idx = 0; row_idx < BASE_BLOCK_SIZE; row_idx++ )
-            {
-                calc_row_idx = row_index + row_idx;
-                z_dest[z_idx++] = src[(calc_row_idx * src_original_n) + calc_col_idx];
-            }
-        }
-        return;
+    if(largest > 0.0) error /= largest;
+
+    double flops = 2.0 * m * n * k;
+    double double_sec = ktiming_diff_sec(&begin_double, &end_double);
+    double mixed_sec = ktiming_diff_sec(&begin_mixed, &end_mixed);
+    printf("Double time in seconds: %f (%.2f GFLOP/s)\n", double_sec, flops / double_sec * 1e-9);
+    printf("Mixed time in seconds: %f (%.2f GFLOP/s)\n", mixed_sec, flops / mixed_sec * 1e-9);
+    printf("Speedup over double: %.2f\n", double_sec / mixed_sec);
+    printf("Normwise error: %.3e (EPSILON %.0e)\n", error, EPSILON);
+
+    if(failed) {
+        fprintf(stderr, "Multiply failed\n");
+    } else if(verify && error > EPSILON) {
+        printf("WRONG RESULT!\n");
+        failed = 1;
+    } else {
+        printf("\nCilk Example: matrix multiplication\n");
+        printf("Options: m = %d, k = %d, n = %d\n\n", m, k, n);
     }
 
-    // compute new location within the morton z buffer
-    int fourth_size = z_dest_size >> 2;
-    REAL *top_left     = z_dest;
-    REAL *bottom_left  = z_dest + fourth_size;
-    REAL *top_right    = z_dest + (z_dest_size >> 1);
-    REAL *bottom_right = z_dest + 3 * fourth_size;
-
-    // recursively sub-partition the matrix until the base case is reached
-    transformMatrixB( src, top_left,     fourth_size, row_index, col_index,                                             matrix_width >> 1, src_original_n );
-    transformMatrixB( src, bottom_left,  fourth_size, row_index + (matrix_width >> 1), col_index,                       matrix_width >> 1, src_original_n );
-    transformMatrixB( src, top_right,    fourth_size, row_index, col_index + (matrix_width >> 1),                       matrix_width >> 1, src_original_n );
-    transformMatrixB( src, bottom_right, fourth_size, row_index + (matrix_width >> 1), col_index + (matrix_width >> 1), matrix_width >> 1, src_original_n );
+    mm_free(A);
+    mm_free(B);
+    mm_free(C);
+    mm_free(R);
+    return failed ? 1 : 0;
 }
 
-void extractResults( REAL *results_dest, REAL *morton_results, int morton_results_size, int row_index, int col_index, int matrix_width, int original_n  )
-{
+template <typename T>
+int run(int m, int n, int k, int verify, const check_options *check, int leaf, int tune, int ooc,
+        const input_files *files) {
 
-    if( matrix_width == BASE_BLOCK_SIZE )
-    {
-        // reached base case
-        int row_idx = 0;
-        int col_idx = 0;
-        int z_idx = 0;
-        int calc_col_idx = 0;
-        int calc_row_idx = 0;
+    typedef typename mm_types<T>::acc acc_t;
 
-        debugPrintf("\n\nextractResults: morton_results=0x%08x, size=%d, width=%d\n", morton_results, morton_results_size, matrix_width);
-        print_mm( morton_results, matrix_width, matrix_width);
+    T *A, *B;
+    acc_t *C;
+    T *A_MORTON, *B_MORTON;
+    acc_t *C_MORTON;
 
-        for( row_idx = 0; row_idx < BASE_BLOCK_SIZE; row_idx++ )
-        {
-            calc_row_idx = row_index + row_idx;
-            for( col_idx = 0; col_idx < BASE_BLOCK_SIZE; col_idx++ )
-            {
-                calc_col_idx = col_index + col_idx;
-                results_dest[(calc_row_idx * original_n) + calc_col_idx] = morton_results[z_idx++];
-            }
-        }
-        return;
+    if(tune && !files->a && !files->b) {
+        int largest = m > n ? m : n;
+        if(k > largest) largest = k;
+        printf("Tuning leaf size ...\n");
+        if(mm_autotune(mm_types<T>::dtype, largest, MM_TUNE_FILE) < 0)
+            fprintf(stderr, "Could not save tuning to %s\n", MM_TUNE_FILE);
     }
 
-    // compute new location within the morton z buffer
-    int fourth_size    = morton_results_size >> 2;
-    REAL *top_left     = morton_results;
-    REAL *top_right    = morton_results + fourth_size;
-    REAL *bottom_left  = morton_results + (morton_results_size >> 1);
-    REAL *bottom_right = morton_results + 3 * (fourth_size);
-
-    // recursively sub-partition the matrix until the base case is reached
-    extractResults( results_dest, top_left,     fourth_size, row_index, col_index,                                             matrix_width >> 1, original_n );
-    extractResults( results_dest, top_right,    fourth_size, row_index, col_index + (matrix_width >> 1),                       matrix_width >> 1, original_n );
-    extractResults( results_dest, bottom_left,  fourth_size, row_index + (matrix_width >> 1), col_index,                       matrix_width >> 1, original_n );
-    extractResults( results_dest, bottom_right, fourth_size, row_index + (matrix_width >> 1), col_index + (matrix_width >> 1), matrix_width >> 1, original_n );
-}
-
-const char *specifiers[] = {"-n", "-c", "-h", 0};
-int opt_types[] = {INTARG, BOOLARG, BOOLARG, 0};
+    mm_options options;
+    mm_get_options(&options);
+    options.leaf_size = leaf > 0 ? leaf : mm_tuned_leaf_size(mm_types<T>::dtype, m, n, k);
+    mm_set_options(&options);
+    mm_get_options(&options);
+    printf("Leaf size: %d\n", options.leaf_size);
+    printf("Leaf kernel: %s\n", mm_kernel_name<T>());
 
-int usage(void) {
-  fprintf(stderr, 
-      "\nUsage: mm_dac [-n #] [-c]\n\n"
-      "Multiplies two randomly generated n x n matrices. To check for\n"
-      "correctness use -c\n");
-  return 1;
-}
-
-int main(int argc, char *argv[]) {
-
-    int n = 2048;  
-    int verify = 0;  
-    int help = 0;
-
-    get_options(argc, argv, specifiers, opt_types, &n, &verify, &help);
-    if (help || argc == 1) return usage();
-
-    REAL *A, *B, *C;
-    REAL *A_MORTON, *B_MORTON, *C_MORTON;
-
-    // determine if we need to apply the interleaving memory policy
-    int numWorkers = __cilkrts_get_nworkers();
+    int numWorkers = mm_get_workers();
+    printf("Parallel backend: %s\n", mm_get_backend());
     printf("numWorkers=%d\n", numWorkers);
-    if(numWorkers > 8)
+    printf("NUMA policy: %s\n", mm_numa_policy_name(options.numa_policy));
+    if(options.numa_policy == MM_NUMA_INTERLEAVE && numa_available() >= 0)
     {
-        printf("Enabling Interleave Page Policy\n");
-        numa_set_interleave_mask( numa_all_cpus_ptr );
+        // spread the dense matrices too; the Morton buffers get it from mm_alloc_morton
+        numa_set_interleave_mask( numa_all_nodes_ptr );
     }
 
-    A = (REAL *) malloc(n * n * sizeof(REAL)); //source matrix 
-    B = (REAL *) malloc(n * n * sizeof(REAL)); //source matrix
-    C = (REAL *) malloc(n * n * sizeof(REAL)); //result matrix
-    A_MORTON = (REAL *) malloc(n * n * sizeof(REAL)); //source matrix 
-    B_MORTON = (REAL *) malloc(n * n * sizeof(REAL)); //source matrix
-    C_MORTON = (REAL *) malloc(n * n * sizeof(REAL)); //result matrix
+    //operands that are mapped or generated in Morton order need no dense copy but for the check
+    int pack_a = !files->a && !files->direct, pack_b = !files->b && !files->direct;
+    A = pack_a || verify ? (T *) mm_alloc((size_t)m * k * sizeof(T)) : 0; //source matrix 
+    B = pack_b || verify ? (T *) mm_alloc((size_t)k * n * sizeof(T)) : 0; //source matrix
+    C = (acc_t *) mm_alloc((size_t)m * n * sizeof(acc_t)); //result matrix, first written by the parallel unpack
+    A_MORTON = files->a ? (T *) mm_packed_data(files->a) : (T *) mm_alloc_morton('A', m, k, sizeof(T)); //source matrix 
+    B_MORTON = files->b ? (T *) mm_packed_data(files->b) : (T *) mm_alloc_morton('B', k, n, sizeof(T)); //source matrix
+    C_MORTON = (acc_t *) mm_alloc_morton('C', m, n, sizeof(acc_t)); //result matrix
     
-    init(A, n); 
-    init(B, n);
-    zero(C, n);
-    zero(C_MORTON, n);
+    clockmark_t begin_init = ktiming_getmark();
+    if(files->a) {
+        if(A) mm_packed_unpack(files->a, A, k);
+    } else {
+        if(A) mm_random(files->seed, m, k, A, k);
+        if(A && files->sparse) keep_diagonal_blocks(A, m, k, files->sparse);
+        if(!pack_a) mm_random_morton('A', files->seed, m, k, A_MORTON);
+    }
+    if(files->b) {
+        if(B) mm_packed_unpack(files->b, B, n);
+    } else {
+        if(B) mm_random(files->seed + 1, k, n, B, n);
+        if(B && files->sparse) keep_diagonal_blocks(B, k, n, files->sparse);
+        if(!pack_b) mm_random_morton('B', files->seed + 1, k, n, B_MORTON);
+    }
+    mm_zero(C_MORTON, mm_morton_size(m, n));
+    clockmark_t end_init = ktiming_getmark();
+    printf("Generate time in seconds: %f\n", ktiming_diff_sec(&begin_init, &end_init));
+
+    counters_start();
+    clockmark_t begin_pack = ktiming_getmark();
+    if(pack_a) mm_pack_a('N', m, k, A, k, A_MORTON);
+    if(pack_b) mm_pack_b('N', k, n, B, n, B_MORTON);
+    clockmark_t end_pack = ktiming_getmark();
+    counters_stop(COUNT_PACK);
+
+    char a_path[256], b_path[256], c_path[256];
+    if(ooc) {
+        //Morton files are streamed as they are, generated operands staged first
+        ooc_path(a_path, sizeof(a_path), 'a');
+        ooc_path(b_path, sizeof(b_path), 'b');
+        ooc_path(c_path, sizeof(c_path), 'c');
+        if(files->a) snprintf(a_path, sizeof(a_path), "%s", files->a_path);
+        if(files->b) snprintf(b_path, sizeof(b_path), "%s", files->b_path);
+        unlink(c_path);
+        printf("Out-of-core budget: %d MiB\n", ooc);
+        if((!files->a && write_file(a_path, A_MORTON, mm_morton_size(m, k) * sizeof(T))) ||
+           (!files->b && write_file(b_path, B_MORTON, mm_morton_size(k, n) * sizeof(T)))) {
+            fprintf(stderr, "Could not write the Morton files to %s\n", a_path);
+            ooc = -1;
+        }
+    }
 
-    transformMatrixA( A, A_MORTON, n * n, 0, 0, n, n );
-    transformMatrixB( B, B_MORTON, n * n, 0, 0, n, n );
-    
+    counters_start();
     clockmark_t begin_rm = ktiming_getmark(); 
-    mat_mul_par(A_MORTON, B_MORTON, C_MORTON, n, n);
+    if(ooc > 0) {
+        if(mm_multiply_files<T>(m, n, k, a_path, b_path, c_path, (size_t) ooc << 20) ||
+           read_file(c_path, C_MORTON, mm_morton_size(m, n) * sizeof(acc_t))) {
+            fprintf(stderr, "Out-of-core multiply failed\n");
+            ooc = -1;
+        }
+    }
+    else if(!ooc) {
+        //mapped files come with their occupancy, the rest are scanned
+        mm_multiply_occupied(m, n, k, A_MORTON, files->a ? files->a->occupancy : 0,
+                             B_MORTON, files->b ? files->b->occupancy : 0, C_MORTON);
+    }
     clockmark_t end_rm = ktiming_getmark();
+    counters_stop(COUNT_MULTIPLY);
+    if(ooc) {
+        if(!files->a) unlink(a_path);
+        if(!files->b) unlink(b_path);
+        unlink(c_path);
+    }
 
-    printf("Elapsed time in seconds: %f\n", ktiming_diff_sec(&begin_rm, &end_rm));
+    counters_start();
+    clockmark_t begin_unpack = ktiming_getmark();
+    mm_unpack(m, n, acc_t(1), C_MORTON, acc_t(0), C, n);
+    clockmark_t end_unpack = ktiming_getmark();
+    counters_stop(COUNT_UNPACK);
 
-    extractResults( C, C_MORTON, n * n, 0, 0, n, n );
+    printf("Pack time in seconds: %f\n", ktiming_diff_sec(&begin_pack, &end_pack));
+    printf("Elapsed time in seconds: %f\n", ktiming_diff_sec(&begin_rm, &end_rm));
+    printf("Unpack time in seconds: %f\n", ktiming_diff_sec(&begin_unpack, &end_unpack));
+    counters_print(1);
 
     debugPrintf("\n\nComputed Results:\n");
-    print_mm( C, n, n);
+    print_mm( C, m, n, n );
 
     if(verify) {
-        printf("Checking results ... \n");
-        REAL *C2 = (REAL *) malloc(n * n * sizeof(REAL));
-        matrixmul(C2, A, B, n);
-        verify = compare_matrix(C, C2, n);
-
-        debugPrintf("\n\nCorrect Results:\n");
-        print_mm( C2, n, n);
-        
-        free(C2);
+        printf("Checking results (%s) ... \n", check->mode == MM_VERIFY_EXACT ? "exact" :
+               check->mode == MM_VERIFY_FREIVALDS ? "Freivalds" : "auto");
+        clockmark_t begin_check = ktiming_getmark();
+        verify = mm_verify(check->mode, m, n, k, (const T *) A, k, (const T *) B, n, C, n,
+                           check->trials, check->rtol, check->atol);
+        clockmark_t end_check = ktiming_getmark();
+        printf("Check time in seconds: %f\n", ktiming_diff_sec(&begin_check, &end_check));
     }
 
-    if(verify) {
+    if(ooc < 0) {
+        verify = -1;
+    } else if(verify) {
         printf("WRONG RESULT!\n");
     } else {
         printf("\nCilk Example: matrix multiplication\n");
-        printf("Options: n = %d\n\n", n);
+        printf("Options: m = %d, k = %d, n = %d\n\n", m, k, n);
     }
 
     //clean up memory
-    delete [] A;
-    delete [] B;
-    delete [] C;
-    delete [] A_MORTON;
-    delete [] B_MORTON;
-    delete [] C_MORTON;
+    mm_free(A);
+    mm_free(B);
+    mm_free(C);
+    if(!files->a) mm_free_morton(A_MORTON);
+    if(!files->b) mm_free_morton(B_MORTON);
+    mm_free_morton(C_MORTON);
 	
-    return 0;
+    return verify ? 1 : 0;
+}
+
+/*
+ * -batch: count independent multiplies of the same shape through
+ * mm_gemm_batch, timed together, and each one checked with -c.
+ */
+template <typename T>
+static int run_batch(int m, int n, int k, int count, int verify, const check_options *check, int leaf,
+                     int seed) {
+
+    typedef typename mm_types<T>::acc acc_t;
+
+    if(leaf > 0) {
+        mm_options options;
+        mm_get_options(&options);
+        options.leaf_size = leaf;
+        mm_set_options(&options);
+    }
+    printf("Parallel backend: %s\n", mm_get_backend());
+    printf("numWorkers=%d\n", mm_get_workers());
+    printf("Batch of %d\n", count);
+
+    mm_gemm_problem<T> *batch = (mm_gemm_problem<T> *) calloc(count, sizeof(mm_gemm_problem<T>));
+    int failed = !batch;
+    for(int p = 0; p < count && !failed; p++) {
+        T *A = (T *) mm_alloc((size_t)m * k * sizeof(T));
+        T *B = (T *) mm_alloc((size_t)k * n * sizeof(T));
+        acc_t *C = (acc_t *) mm_alloc((size_t)m * n * sizeof(acc_t));
+        mm_gemm_problem<T> problem = { m, n, k, A, k, B, n, C, n };
+        batch[p] = problem;
+        if(!A || !B || !C) {
+            failed = 1;
+            break;
+        }
+        mm_random(seed + 2 * p, m, k, A, k);
+        mm_random(seed + 2 * p + 1, k, n, B, n);
+    }
+    if(failed) {
+        fprintf(stderr, "Out of memory\n");
+    } else {
+        clockmark_t begin = ktiming_getmark();
+        failed = mm_gemm_batch<T>('N', 'N', acc_t(1), acc_t(0), batch, count) != 0;
+        clockmark_t end = ktiming_getmark();
+        printf("Elapsed time in seconds: %f\n", ktiming_diff_sec(&begin, &end));
+        if(failed) fprintf(stderr, "Batch multiply failed\n");
+    }
+
+    if(!failed && verify) {
+        int wrong = 0;
+        for(int p = 0; p < count; p++)
+            wrong += mm_verify(check->mode, m, n, k, (const T *) batch[p].A, k, (const T *) batch[p].B, n,
+                               batch[p].C, n, check->trials, check->rtol, check->atol) != 0;
+        printf("Wrong results: %d of %d\n", wrong, count);
+        if(wrong) {
+            printf("WRONG RESULT!\n");
+            failed = 1;
+        }
+    }
+    if(!failed) {
+        printf("\nCilk Example: matrix multiplication\n");
+        printf("Options: m = %d, k = %d, n = %d\n\n", m, k, n);
+    }
+
+    for(int p = 0; batch && p < count; p++) {
+        mm_free((void *) batch[p].A);
+        mm_free((void *) batch[p].B);
+        mm_free(batch[p].C);
+    }
+    free(batch);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    int n = 2048;  
+    int m = 0;
+    int k = 0;
+    int verify = 0;  
+    int help = 0;
+    char kernel_opt[32] = "";
+    char type_opt[32] = "double";
+    int strassen = 0;
+    int leaf = 0;
+    int tune = 0;
+    int grain = 0;
+    int temp = 0;
+    char numa_opt[32] = "";
+    int nodes = 0;
+    char huge_opt[32] = "transparent";
+    int prefault = 0;
+    char verify_opt[32] = "auto";
+    check_options check = { MM_VERIFY_AUTO, 0, -1.0, -1.0 };
+    int bench = 0;
+    char sizes_opt[256] = "";
+    char workers_opt[256] = "";
+    char variants_opt[256] = "classic";
+    char csv_opt[256] = "";
+    char json_opt[256] = "";
+    char events_opt[256] = "";
+    int per_cpu = 0;
+    int ooc = 0;
+    char a_opt[256] = "";
+    char b_opt[256] = "";
+    int seed = 0;
+    int direct = 0;
+    char serve_opt[256] = "";
+    char client_opt[256] = "";
+    client_options client_opts = { client_opt, type_opt, 0, 0, 0, 100, 1, 0, 0, 0, 0 };
+    char backend_opt[32] = "";
+    char backends_opt[256] = "";
+    char mixed_opt[32] = "";
+    int batch = 0;
+    int sparse = 0;
+    bench_options bench_opts = { backends_opt, sizes_opt, workers_opt, variants_opt, 1, 5, 0, csv_opt, json_opt };
+
+    get_options(argc, argv, specifiers, opt_types, &n, &m, &k, &verify, &help, kernel_opt, type_opt, &strassen,
+                &leaf, &tune, &grain, &temp, numa_opt, &nodes,
+                huge_opt, &prefault, verify_opt, &check.trials, &check.rtol, &check.atol,
+                &bench, sizes_opt, workers_opt, variants_opt, &bench_opts.warmup, &bench_opts.reps, csv_opt,
+                json_opt, events_opt, &per_cpu, &ooc, a_opt, b_opt, &seed, &direct,
+                serve_opt, client_opt, &client_opts.jobs, &client_opts.clients, &client_opts.cache_b,
+                &client_opts.stop, backend_opt, backends_opt, mixed_opt, &batch, &sparse);
+    if (help || argc == 1) return usage();
+    if (m <= 0) m = n;
+    if (k <= 0) k = n;
+    if (n <= 0 || ooc < 0 || batch < 0 || sparse < 0) return usage();
+
+    //shapes, type and leaf size come from the Morton files when given
+    input_files files = { a_opt, b_opt, 0, 0, seed, direct, sparse };
+    if (a_opt[0] || b_opt[0]) {
+        char side;
+        mm_dtype a_type, b_type;
+        int rows, cols, a_leaf = 0, b_leaf = 0;
+        if (a_opt[0] && (files.a = mm_packed_map(a_opt, 0))) {
+            mm_packed_info(files.a, &side, &a_type, &rows, &cols, &a_leaf);
+            if (side != 'A') {
+                fprintf(stderr, "%s does not hold an A operand\n", a_opt);
+                return 1;
+            }
+            m = rows;
+            k = cols;
+            snprintf(type_opt, sizeof(type_opt), "%s", mm_dtype_name(a_type));
+        }
+        if (b_opt[0] && (files.b = mm_packed_map(b_opt, 0))) {
+            mm_packed_info(files.b, &side, &b_type, &rows, &cols, &b_leaf);
+            if (side != 'B') {
+                fprintf(stderr, "%s does not hold a B operand\n", b_opt);
+                return 1;
+            }
+            if (files.a && (rows != k || b_type != a_type || b_leaf != a_leaf)) {
+                fprintf(stderr, "%s and %s do not fit together\n", a_opt, b_opt);
+                return 1;
+            }
+            k = rows;
+            n = cols;
+            snprintf(type_opt, sizeof(type_opt), "%s", mm_dtype_name(b_type));
+        }
+        if ((a_opt[0] && !files.a) || (b_opt[0] && !files.b)) {
+            fprintf(stderr, "Could not map %s as a Morton file\n", a_opt[0] && !files.a ? a_opt : b_opt);
+            return 1;
+        }
+        leaf = a_leaf ? a_leaf : b_leaf;
+    }
+
+    mm_set_kernel(kernel_opt[0] ? kernel_opt : 0);
+    if (backend_opt[0] && mm_set_backend(backend_opt)) {
+        fprintf(stderr, "Backend %s is not built in (built in: %s)\n", backend_opt, mm_backend_names());
+        return 1;
+    }
+    if (!bench && workers_opt[0]) mm_set_workers(atoi(workers_opt));
+
+    mm_options options;
+    mm_get_options(&options);
+    options.strassen_depth = strassen;
+    options.spawn_grain = grain;
+    options.temp_depth = temp;
+    if (numa_opt[0])
+        options.numa_policy = mm_numa_policy_from_name(numa_opt);
+    else
+        options.numa_policy = mm_get_workers() > 8 ? MM_NUMA_INTERLEAVE : MM_NUMA_DEFAULT;
+    if (options.numa_policy < 0) return usage();
+    options.numa_nodes = nodes;
+    if (!strcmp(huge_opt, "none")) options.huge_pages = MM_HUGE_PAGES_NONE;
+    else if (!strcmp(huge_opt, "transparent")) options.huge_pages = MM_HUGE_PAGES_TRANSPARENT;
+    else if (!strcmp(huge_opt, "explicit")) options.huge_pages = MM_HUGE_PAGES_EXPLICIT;
+    else return usage();
+    options.prefault = prefault;
+    if (!strcmp(verify_opt, "auto")) check.mode = MM_VERIFY_AUTO;
+    else if (!strcmp(verify_opt, "freivalds")) check.mode = MM_VERIFY_FREIVALDS;
+    else if (!strcmp(verify_opt, "exact")) check.mode = MM_VERIFY_EXACT;
+    else return usage();
+    mm_set_options(&options);
+    printf("Spawn grain: %d\n", grain > 0 ? grain : MM_DEFAULT_SPAWN_GRAIN);
+    mm_load_tuning(MM_TUNE_FILE);
+    printf("Strassen depth: %d\n", strassen);
+    printf("Temporary-buffer depth: %d\n", temp);
+    printf("Huge pages: %s%s\n", huge_opt, prefault ? ", prefaulted" : "");
+    printf("Element type: %s\n", type_opt);
+
+    if (events_opt[0]) {
+        int events = counters_init(events_opt, per_cpu);
+        if (events < 0) fprintf(stderr, "No hardware counters: PAPI is not built in or failed to start\n");
+        else if (events == 0) fprintf(stderr, "No hardware counters: none of the events can be counted\n");
+    }
+
+    int result;
+    if (serve_opt[0]) {
+        //-leaf fixes the leaf size of every job instead of the tuned one
+        if (leaf > 0) {
+            options.leaf_size = leaf;
+            mm_set_options(&options);
+        }
+        result = run_server(serve_opt);
+    }
+    else if (client_opt[0]) {
+        client_opts.m = m;
+        client_opts.n = n;
+        client_opts.k = k;
+        client_opts.verify = verify;
+        client_opts.seed = seed;
+        result = run_client(&client_opts);
+    }
+    else if (bench) {
+        if (!sizes_opt[0]) snprintf(sizes_opt, sizeof(sizes_opt), "%dx%dx%d", m, k, n);
+        bench_opts.leaf = leaf;
+        result = run_bench(type_opt, &bench_opts);
+    }
+    else if (mixed_opt[0]) {
+        if (strcmp(type_opt, "double") || files.a || files.b) {
+            fprintf(stderr, "-mixed multiplies generated double matrices only\n");
+            result = -1;
+        }
+        else if (!strcmp(mixed_opt, "float")) result = run_mixed(m, n, k, MM_MIXED_FLOAT, verify, leaf, seed);
+        else if (!strcmp(mixed_opt, "refine")) result = run_mixed(m, n, k, MM_MIXED_REFINE, verify, leaf, seed);
+        else result = -1;
+    }
+    else if (sparse && (files.a || files.b || direct || batch)) {
+        fprintf(stderr, "-sparse needs generated operands that are packed\n");
+        result = -1;
+    }
+    else if (batch) {
+        if (!strcmp(type_opt, "double")) result = run_batch<double>(m, n, k, batch, verify, &check, leaf, seed);
+        else if (!strcmp(type_opt, "float")) result = run_batch<float>(m, n, k, batch, verify, &check, leaf, seed);
+        else if (!strcmp(type_opt, "int8")) result = run_batch<int8_t>(m, n, k, batch, verify, &check, leaf, seed);
+        else if (!strcmp(type_opt, "complex64")) result = run_batch< std::complex<float> >(m, n, k, batch, verify, &check, leaf, seed);
+        else if (!strcmp(type_opt, "complex128")) result = run_batch< std::complex<double> >(m, n, k, batch, verify, &check, leaf, seed);
+        else result = -1;
+    }
+    else if (!strcmp(type_opt, "double")) result = run<double>(m, n, k, verify, &check, leaf, tune, ooc, &files);
+    else if (!strcmp(type_opt, "float")) result = run<float>(m, n, k, verify, &check, leaf, tune, ooc, &files);
+    else if (!strcmp(type_opt, "int8")) result = run<int8_t>(m, n, k, verify, &check, leaf, tune, ooc, &files);
+    else if (!strcmp(type_opt, "complex64")) result = run< std::complex<float> >(m, n, k, verify, &check, leaf, tune, ooc, &files);
+    else if (!strcmp(type_opt, "complex128")) result = run< std::complex<double> >(m, n, k, verify, &check, leaf, tune, ooc, &files);
+    else result = -1;
+
+    if (events_opt[0]) counters_finish();
+    mm_packed_free(files.a);
+    mm_packed_free(files.b);
+    return result < 0 ? usage() : result;
 }
@@ -0,0 +1,525 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_DAC_H_
+#define _MM_DAC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <complex>
+
+/*
+ * Public interface of libmmdac, the divide-and-conquer Morton-Z matrix
+ * multiply engine.  All matrices are row major.  trans arguments take
+ * 'N' (use the matrix as is) or 'T' (use its transpose), as in BLAS.
+ *
+ * The one-shot entry point is mm_gemm (mm_dgemm for doubles).  Callers that
+ * want to manage the Morton buffers themselves can run the three phases
+ * separately:
+ *
+ *     mm_pack_a(...); mm_pack_b(...);      // row major -> Morton-Z
+ *     mm_zero(c_morton, mm_morton_size(m, n));
+ *     mm_multiply(...);                    // c_morton += a_morton * b_morton
+ *     mm_unpack(...);                      // C = alpha * c_morton + beta * C
+ *
+ * Every call is a template over the element type of A and B.  The library
+ * provides float, double, int8_t, std::complex<float> and
+ * std::complex<double>.  C has the accumulator type mm_types<T>::acc, which
+ * is T itself except for int8_t operands, which accumulate into int32_t.
+ */
+
+enum mm_dtype {
+    MM_FLOAT32,
+    MM_FLOAT64,
+    MM_INT8,
+    MM_INT32,
+    MM_COMPLEX64,
+    MM_COMPLEX128
+};
+
+template <typename T> struct mm_types;
+
+template <> struct mm_types<float> {
+    typedef float acc;
+    static const mm_dtype dtype = MM_FLOAT32;
+};
+template <> struct mm_types<double> {
+    typedef double acc;
+    static const mm_dtype dtype = MM_FLOAT64;
+};
+template <> struct mm_types<int8_t> {
+    typedef int32_t acc;
+    static const mm_dtype dtype = MM_INT8;
+};
+template <> struct mm_types< std::complex<float> > {
+    typedef std::complex<float> acc;
+    static const mm_dtype dtype = MM_COMPLEX64;
+};
+template <> struct mm_types< std::complex<double> > {
+    typedef std::complex<double> acc;
+    static const mm_dtype dtype = MM_COMPLEX128;
+};
+
+// keeps scalar arguments such as alpha out of template argument deduction
+template <typename T> struct mm_identity { typedef T type; };
+
+/*
+ * Number of elements in the Morton buffer of a rows x cols matrix.  Each
+ * dimension is rounded up to whole leaf tiles only.
+ */
+size_t mm_morton_size(int rows, int cols);
+
+/* Pack op(A), an m x k matrix, into the A-style Morton buffer a_morton. */
+template <typename T>
+void mm_pack_a(char trans, int m, int k, const T *A, int lda, T *a_morton);
+
+/* Pack op(B), a k x n matrix, into the B-style Morton buffer b_morton. */
+template <typename T>
+void mm_pack_b(char trans, int k, int n, const T *B, int ldb, T *b_morton);
+
+/*
+ * Deterministic random matrices.  Element (i, j) is a function of seed, i
+ * and j only (a Philox-4x32-10 counter-based generator), so matrices are
+ * filled in parallel and a seed gives the same matrix on any number of
+ * workers.  Values are integers in [0, 32767] (both parts for complex
+ * types) and span [-128, 127] for int8.  mm_random fills the rows x cols
+ * row-major M; mm_random_morton writes the same matrix straight into an
+ * A-style ('A') or B-style ('B') Morton buffer of the current leaf size,
+ * which is exactly what packing M would give, without M or the pack pass.
+ */
+template <typename T>
+void mm_random(uint64_t seed, int rows, int cols, T *M, int ld);
+
+template <typename T>
+void mm_random_morton(char side, uint64_t seed, int rows, int cols, T *morton);
+
+/* Clear a Morton buffer of count elements in parallel. */
+template <typename U>
+void mm_zero(U *morton, size_t count);
+
+/* c_morton (m x n) += a_morton (m x k) * b_morton (k x n). */
+template <typename T>
+void mm_multiply(int m, int n, int k, const T *a_morton,
+                 const T *b_morton, typename mm_types<T>::acc *c_morton);
+
+/*
+ * C = alpha * c_morton + beta * C for the m x n matrix C.  C is not read
+ * when beta is zero.
+ */
+template <typename U>
+void mm_unpack(int m, int n, typename mm_identity<U>::type alpha, const U *c_morton,
+               typename mm_identity<U>::type beta, U *C, int ldc);
+
+/*
+ * C = alpha * op(A) * op(B) + beta * C, where op(A) is m x k and op(B) is
+ * k x n.  Returns 0 on success and -1 on bad arguments or allocation failure.
+ *
+ * When n or m is at most MM_SKINNY_MAX (matrix-vector products and other
+ * skinny shapes) nothing is packed: the large operand is streamed once in
+ * parallel row panels against a transposed copy of the small one.
+ */
+#define MM_SKINNY_MAX 32
+
+template <typename T>
+int mm_gemm(char transa, char transb, int m, int n, int k,
+            typename mm_types<T>::acc alpha, const T *A, int lda,
+            const T *B, int ldb,
+            typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc);
+
+/*
+ * Elementwise epilogue applied to C as it is unpacked, while each finished
+ * row segment of a leaf tile is still in cache, in place of extra passes
+ * over C.  After C = alpha * op(A) * op(B) + beta * C, in this order:
+ *
+ *   bias      0 or n values, bias[j] is added to column j
+ *   row_bias  0 or m values, row_bias[i] is added to row i
+ *   relu      nonzero: max(x, 0)
+ *   clamp     nonzero: x clamped into [lo, hi]
+ *   hook      0 or hook(x, count, i, j, arg) on the count elements
+ *             x[0..count) = C(i, j..j+count); it runs on many workers at
+ *             once and must only touch the elements it is given
+ *
+ * Zero-initialize the struct and set the fields needed.
+ */
+template <typename U>
+struct mm_epilogue {
+    const U *bias;
+    const U *row_bias;
+    int relu;
+    int clamp;
+    U lo, hi;
+    void (*hook)(U *x, int count, int row, int col, void *arg);
+    void *arg;
+};
+
+/*
+ * mm_gemm and mm_unpack with an epilogue, which may be 0.  They return -1
+ * on bad arguments, including relu or clamp for a complex type.
+ */
+template <typename T>
+int mm_gemm_epilogue(char transa, char transb, int m, int n, int k,
+                     typename mm_types<T>::acc alpha, const T *A, int lda,
+                     const T *B, int ldb,
+                     typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc,
+                     const mm_epilogue<typename mm_types<T>::acc> *epilogue);
+
+template <typename U>
+int mm_unpack_epilogue(int m, int n, typename mm_identity<U>::type alpha, const U *c_morton,
+                       typename mm_identity<U>::type beta, U *C, int ldc, const mm_epilogue<U> *epilogue);
+
+int mm_dgemm(char transa, char transb, int m, int n, int k,
+             double alpha, const double *A, int lda,
+             const double *B, int ldb,
+             double beta, double *C, int ldc);
+
+/*
+ * Mixed precision for mm_dgemm.  The operands are packed as floats, the
+ * leaf kernels multiply and sum them in single precision and the leaf
+ * results accumulate into double.
+ *
+ *   MM_MIXED_FLOAT   A and B rounded to float, one multiply at float
+ *                    speed; about single precision accuracy
+ *   MM_MIXED_REFINE  each k run of a leaf is split into a hi part on a
+ *                    grid coarse enough that the float sums of hi * hi
+ *                    are exact, plus a float lo remainder; two correction
+ *                    multiplies add hi * lo and lo * B, for an error some
+ *                    thousand times below single precision at three
+ *                    multiplies' cost
+ *
+ * The elements of A and B must lie in the range of float.  Strassen levels
+ * are not used.  Returns as mm_dgemm, and -1 for an unknown mode.
+ */
+enum mm_mixed_mode {
+    MM_MIXED_FLOAT,
+    MM_MIXED_REFINE
+};
+
+int mm_dgemm_mixed(char transa, char transb, int m, int n, int k,
+                   double alpha, const double *A, int lda,
+                   const double *B, int ldb,
+                   double beta, double *C, int ldc, int mode);
+
+/*
+ * Out-of-core c_morton += a_morton * b_morton for Morton buffers that live
+ * in files, for problems whose buffers do not fit in memory.  The files hold
+ * the buffers exactly as mm_pack_a, mm_pack_b and mm_multiply lay them out
+ * with the current leaf size, either raw or, for A and B, as Morton files
+ * from mm_packed_save (see below); c_path is a raw buffer, created and
+ * extended with zeros as needed.  The files are memory mapped and the multiply recurses on their
+ * quadrants until the A, B and C blocks of one step take at most half of
+ * budget bytes (0: half of the free memory).  The next step's blocks are
+ * read in by a helper thread during each step and every block of C is
+ * written back as soon as it is final.  Strassen or temporary-buffer
+ * workspace for the steps comes on top of the budget.  Returns 0, or -1 on
+ * bad arguments or when a file cannot be opened, is too short or cannot
+ * be mapped.
+ */
+template <typename T>
+int mm_multiply_files(int m, int n, int k, const char *a_path, const char *b_path,
+                      const char *c_path, size_t budget);
+
+/*
+ * Opaque handle to a matrix packed once into Morton-Z order, for operands
+ * that are multiplied many times (e.g. a weight matrix B against a stream
+ * of different A).  A handle is read-only once created and may be shared by
+ * any number of concurrent multiplies.
+ */
+typedef struct mm_packed mm_packed;
+
+/*
+ * Pack op(M), a rows x cols matrix, for use as the A ('A') or B ('B')
+ * operand of later multiplies.  Returns 0 on bad arguments or allocation
+ * failure.  Release it with mm_packed_free.
+ */
+template <typename T>
+mm_packed *mm_pack(char side, char trans, int rows, int cols, const T *M, int ld);
+void mm_packed_free(mm_packed *packed);
+
+/*
+ * mm_gemm with a pre-packed k x n B, which skips the pack pass and the
+ * Morton B allocation on every call.  B must hold the same type as A.
+ */
+template <typename T>
+int mm_gemm_packed_b(char transa, int m, int n, int k,
+                     typename mm_types<T>::acc alpha, const T *A, int lda,
+                     const mm_packed *B,
+                     typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc);
+
+int mm_dgemm_packed_b(char transa, int m, int n, int k,
+                      double alpha, const double *A, int lda,
+                      const mm_packed *B,
+                      double beta, double *C, int ldc);
+
+/*
+ * C = alpha * A * B + beta * C with both operands pre-packed.  U is the
+ * accumulator type; the handles must hold the matching operand type.
+ */
+template <typename U>
+int mm_gemm_packed(typename mm_identity<U>::type alpha, const mm_packed *A, const mm_packed *B,
+                   typename mm_identity<U>::type beta, U *C, int ldc);
+
+/*
+ * Copy the matrix a handle holds back out into M, rows x cols and row
+ * major, whatever its side.  T must be its element type.  Returns 0 or -1.
+ */
+template <typename T>
+int mm_packed_unpack(const mm_packed *packed, T *M, int ld);
+
+/* What a handle holds, and its Morton buffer; any output may be 0. */
+void mm_packed_info(const mm_packed *packed, char *side, mm_dtype *dtype, int *rows, int *cols,
+                    int *leaf_size);
+const void *mm_packed_data(const mm_packed *packed);
+
+/*
+ * Morton files.  mm_packed_save writes a handle to path as a small header
+ * (element type, side, shape, leaf size and a checksum of the data)
+ * followed by the Morton buffer exactly as it is in memory.  mm_packed_map
+ * maps such a file read-only and returns a handle whose data is the
+ * mapping itself, so loading takes neither a copy nor a pack pass and pages
+ * are read as the multiply first touches them.  With check set it verifies
+ * the checksum first, which reads the whole file once.  mm_packed_save
+ * returns 0 or -1; mm_packed_map returns 0 when the file cannot be mapped,
+ * is not a Morton file or fails the check.  Free the handle with
+ * mm_packed_free.  The mm_convert tool writes these files from row-major
+ * raw or CSV data.
+ */
+int mm_packed_save(const mm_packed *packed, const char *path);
+mm_packed *mm_packed_map(const char *path, int check);
+
+/*
+ * Batched GEMM: C_i = alpha * op(A_i) * op(B_i) + beta * C_i for every
+ * problem of batch, with the same transposes, alpha and beta throughout.
+ * Problems up to about 256^3 multiply-adds each run whole on one worker,
+ * many at a time, packed into per-worker slots of one shared workspace, or
+ * streamed without packing when m or n is at most MM_SKINNY_MAX, as mm_gemm
+ * does; larger ones are multiplied one after another like mm_gemm.
+ * The C_i must not overlap.  Returns 0, or -1 on a bad argument (before
+ * anything is computed) or when memory runs out.
+ */
+template <typename T>
+struct mm_gemm_problem {
+    int m, n, k;
+    const T *A;
+    int lda;
+    const T *B;
+    int ldb;
+    typename mm_types<T>::acc *C;
+    int ldc;
+};
+
+template <typename T>
+int mm_gemm_batch(char transa, char transb, typename mm_types<T>::acc alpha, typename mm_types<T>::acc beta,
+                  const mm_gemm_problem<T> *batch, int count);
+
+/*
+ * Check C (m x n) against A (m x k) * B (k x n), all row major.  Returns 0
+ * when they agree, 1 when they do not and -1 on bad arguments or no memory.
+ *
+ * MM_VERIFY_FREIVALDS  compares C r with A (B r) for trials random +-1
+ *                      vectors r, O(mk + kn + mn) per trial; a wrong C
+ *                      survives each trial with probability at most 1/2
+ * MM_VERIFY_EXACT      recomputes every element, O(mnk) but parallel and
+ *                      blocked; meant for small problems
+ * MM_VERIFY_AUTO       exact up to about 512^3 multiply-adds, else Freivalds
+ *
+ * An element passes when |computed - reference| <= atol + rtol * s, where s
+ * is the same sum taken over |a| |b|, so results that cancel to near zero
+ * are not held to a relative error.  trials <= 0 uses MM_VERIFY_TRIALS and
+ * a negative rtol or atol picks the default for the type (exact for int8).
+ */
+enum mm_verify_mode {
+    MM_VERIFY_AUTO,
+    MM_VERIFY_FREIVALDS,
+    MM_VERIFY_EXACT
+};
+
+#define MM_VERIFY_TRIALS 8
+
+template <typename T>
+int mm_verify(int mode, int m, int n, int k, const T *A, int lda, const T *B, int ldb,
+              const typename mm_types<T>::acc *C, int ldc, int trials, double rtol, double atol);
+
+// leaf tile width of the phase calls and Morton files when mm_options.leaf_size is 0
+#define MM_DEFAULT_LEAF_SIZE 32
+
+// spawn grain used when mm_options.spawn_grain is 0
+#define MM_DEFAULT_SPAWN_GRAIN 64
+
+/*
+ * Process-wide engine settings, read at the start of every multiply.
+ *
+ * leaf_size       width of the square leaf tiles of the Morton layout.  The
+ *                 layout depends on it, so a buffer must be multiplied and
+ *                 unpacked with the leaf size it was packed with (packed
+ *                 handles remember theirs).  0 lets mm_gemm pick the tuned
+ *                 size for each problem (see mm_autotune); the phase calls
+ *                 then use MM_DEFAULT_LEAF_SIZE.
+ * strassen_depth  number of top recursion levels that use Strassen-Winograd
+ *                 (7 sub-multiplies instead of 8) before falling back to
+ *                 the classical recursion; 0 disables it.  A level only uses
+ *                 it when the tile grids of A, B and C split evenly, and
+ *                 never for int8 operands, whose sums would overflow.
+ * spawn_grain     sub-multiplies whose m, n and k are all at most this many
+ *                 elements are computed by a serial recursion without
+ *                 spawns; 0 uses MM_DEFAULT_SPAWN_GRAIN.  Anything below the
+ *                 leaf size spawns all the way down to single tiles.
+ * temp_depth      number of top classical levels that run all eight
+ *                 sub-products at once, half of them into a temporary
+ *                 buffer that is added into C afterwards, instead of two
+ *                 synchronized rounds of four.  This raises parallelism at
+ *                 the cost of workspace that doubles with every level; the
+ *                 depth is lowered until it fits in half the free memory.
+ *                 0 disables it, and it is not combined with Strassen.
+ * numa_policy     page placement of buffers from mm_alloc_morton, one of
+ *                 mm_numa_policy.  Under MM_NUMA_PARTITIONED the workers
+ *                 are also pinned evenly over the nodes for the multiply,
+ *                 and each runs the pieces of C bound to its own node
+ *                 before helping others.
+ * numa_nodes      number of NUMA nodes the policy spreads over; 0 uses all.
+ * huge_pages      page size of new arena buffers (see mm_alloc), one of
+ *                 mm_huge_pages; buffers of 2 MB and up are huge page
+ *                 aligned.  Explicit huge pages need a reserved hugetlbfs
+ *                 pool and fall back to transparent ones.
+ * prefault        touch every page of a new arena buffer up front, from
+ *                 parallel workers, so the multiply itself takes no faults.
+ */
+enum mm_huge_pages {
+    MM_HUGE_PAGES_NONE,
+    MM_HUGE_PAGES_TRANSPARENT,
+    MM_HUGE_PAGES_EXPLICIT
+};
+
+typedef struct {
+    int strassen_depth;
+    int leaf_size;
+    int spawn_grain;
+    int temp_depth;
+    int numa_policy;
+    int numa_nodes;
+    int huge_pages;
+    int prefault;
+} mm_options;
+
+void mm_get_options(mm_options *options);
+void mm_set_options(const mm_options *options);
+
+/*
+ * NUMA placement of Morton buffers.
+ *
+ * MM_NUMA_DEFAULT      whatever the process memory policy is
+ * MM_NUMA_INTERLEAVE   pages round-robin over the nodes
+ * MM_NUMA_FIRST_TOUCH  each page on the node of the worker that first
+ *                      writes it, i.e. of the parallel pack or mm_zero
+ * MM_NUMA_PARTITIONED  the buffer is cut at quadrant boundaries and each
+ *                      piece bound to one node, so the same quadrant of A,
+ *                      B and C lives on the same node
+ */
+enum mm_numa_policy {
+    MM_NUMA_DEFAULT,
+    MM_NUMA_INTERLEAVE,
+    MM_NUMA_FIRST_TOUCH,
+    MM_NUMA_PARTITIONED
+};
+
+/*
+ * The engine's arena.  mm_alloc returns a buffer of at least bytes that is
+ * page aligned (so also 64-byte aligned for SIMD loads) and backed by huge
+ * pages as mm_options.huge_pages allows.  mm_free keeps it mapped and hands
+ * it to the next request of about the same size, so a loop of same-sized
+ * multiplies stops allocating and faulting after its first iteration;
+ * mm_free_workspace unmaps the buffers not in use.
+ */
+void *mm_alloc(size_t bytes);
+void mm_free(void *buffer);
+
+/*
+ * Allocate a Morton buffer for a rows x cols matrix of elem_size-byte
+ * elements, used as side 'A', 'B' or 'C', from the arena with the leaf size
+ * and NUMA policy currently set.  A new buffer is placed but not touched
+ * (unless mm_options.prefault), so the pack or mm_zero that follows decides
+ * first-touch placement; a reused one keeps its earlier placement.  Free
+ * with mm_free_morton.
+ */
+void *mm_alloc_morton(char side, int rows, int cols, size_t elem_size);
+void mm_free_morton(void *buffer);
+
+/* Policy names ("default", "interleave", "first-touch", "partitioned"). */
+const char *mm_numa_policy_name(int policy);
+int mm_numa_policy_from_name(const char *name);
+
+/*
+ * Leaf size auto-tuning.  Tuned sizes are kept per element type, problem
+ * size range (powers of two) and worker count, and persisted in a small
+ * text file, MM_TUNE_FILE in the working directory by default.
+ *
+ * mm_autotune times a multiply of two n x n matrices at each candidate leaf
+ * size, records the fastest and rewrites path with it; it returns the chosen
+ * size or -1.  mm_load_tuning reads a file written by earlier runs and
+ * returns the number of entries loaded or -1 if it cannot be read.
+ * mm_tuned_leaf_size returns the tuned size for an m x k by k x n problem.
+ * When nothing close has been tuned it returns 64, or 32 for the complex
+ * types, halved while the padding to whole tiles would double the work.
+ */
+#define MM_TUNE_FILE "mm_dac.tune"
+
+int mm_autotune(mm_dtype dtype, int n, const char *path);
+int mm_load_tuning(const char *path);
+int mm_tuned_leaf_size(mm_dtype dtype, int m, int n, int k);
+
+/* Short name of an element type ("double", "int8", ...). */
+const char *mm_dtype_name(mm_dtype dtype);
+
+/*
+ * Unmap the idle arena buffers the engine keeps for reuse between
+ * multiplies (Strassen temporaries, Morton buffers, mm_alloc buffers).
+ */
+void mm_free_workspace(void);
+
+/*
+ * Select the leaf kernel ("scalar", "avx2", "avx512") for every element
+ * type, or the best one the CPU supports when name is 0.  A type without
+ * the requested kernel falls back to its best one.  Returns the name of the
+ * double kernel; mm_kernel_name<T>() reports the one in use for T.  Must
+ * not be called while a multiply is running.
+ */
+const char *mm_set_kernel(const char *name);
+
+template <typename T>
+const char *mm_kernel_name(void);
+
+/*
+ * Select the parallel backend every multiply runs on: "cilk" (Cilk Plus),
+ * "openmp" (OpenMP tasks), "threads" (the engine's own work-stealing pool
+ * of std::threads) or "serial", of those built in.  mm_backend_names lists
+ * the built-in ones, comma separated, the default first; $MM_BACKEND
+ * overrides the default.  mm_set_backend returns -1 for a backend that is
+ * not built in.  mm_set_workers asks the backend for that many workers and
+ * returns the number it runs with.  Neither may be called while a multiply
+ * is running.
+ */
+int mm_set_backend(const char *name);
+const char *mm_get_backend(void);
+const char *mm_backend_names(void);
+int mm_get_workers(void);
+int mm_set_workers(int workers);
+
+#endif  // _MM_DAC_H_
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mm_dac.h"
+#include "mm_packed.h"
+#include "mm_parallel.h"
+
+// the checksum hashes the data in chunks of this many bytes in parallel
+#define CHECKSUM_CHUNK ((size_t) 1 << 20)
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+size_t mm_dtype_size(mm_dtype dtype)
+{
+    switch( dtype )
+    {
+    case MM_FLOAT32: return sizeof(float);
+    case MM_FLOAT64: return sizeof(double);
+    case MM_INT8: return sizeof(int8_t);
+    case MM_INT32: return sizeof(int32_t);
+    case MM_COMPLEX64: return sizeof(std::complex<float>);
+    case MM_COMPLEX128: return sizeof(std::complex<double>);
+    }
+    return 0;
+}
+
+// FNV-1a over 8-byte words, then over the bytes left at the end
+static uint64_t hash_bytes( const unsigned char *data, size_t bytes )
+{
+    uint64_t hash = FNV_OFFSET;
+    size_t i = 0;
+    for( ; i + 8 <= bytes; i += 8 )
+    {
+        uint64_t word;
+        memcpy( &word, data + i, 8 );
+        hash = ( hash ^ word ) * FNV_PRIME;
+    }
+    for( ; i < bytes; i++ )
+        hash = ( hash ^ data[i] ) * FNV_PRIME;
+    return hash;
+}
+
+/*
+ * Each chunk is hashed on its own and the chunk hashes are hashed in order,
+ * so the result does not depend on the number of workers.
+ */
+uint64_t mm_file_checksum(const void *data, size_t bytes)
+{
+    size_t chunks = ( bytes + CHECKSUM_CHUNK - 1 ) / CHECKSUM_CHUNK;
+    if( chunks <= 1 ) return hash_bytes( (const unsigned char *) data, bytes );
+
+    uint64_t *hashes = (uint64_t *) malloc( chunks * sizeof(uint64_t) );
+    if( !hashes ) return 0;
+    mm_parallel_for( 0, chunks, [&]( size_t c ) {
+        size_t begin = c * CHECKSUM_CHUNK;
+        size_t len = bytes - begin < CHECKSUM_CHUNK ? bytes - begin : CHECKSUM_CHUNK;
+        hashes[c] = hash_bytes( (const unsigned char *) data + begin, len );
+    } );
+    uint64_t hash = hash_bytes( (const unsigned char *) hashes, chunks * sizeof(uint64_t) );
+    free( hashes );
+    return hash;
+}
+
+// data bytes of a header's matrix, 0 if the header does not describe one
+static size_t header_data_bytes( const mm_file_header *header )
+{
+    size_t elem = mm_dtype_size( (mm_dtype) header->dtype );
+    uint64_t bs = header->leaf_size;
+    if( !elem || bs < 1 || header->rows < 1 || header->cols < 1 ||
+        header->rows > 0x7fffffff || header->cols > 0x7fffffff ) return 0;
+    return (size_t)( ( header->rows + bs - 1 ) / bs ) * ( ( header->cols + bs - 1 ) / bs ) * bs * bs * elem;
+}
+
+int mm_file_read_header(const char *path, mm_file_header *header)
+{
+    FILE *file = fopen( path, "rb" );
+    if( !file ) return -1;
+    size_t got = fread( header, 1, sizeof(*header), file );
+    fclose( file );
+
+    if( got < sizeof(header->magic) || memcmp( header->magic, MM_FILE_MAGIC, sizeof(header->magic) ) )
+        return 0;
+    if( got < sizeof(*header) || header->version != MM_FILE_VERSION ||
+        header->data_offset < sizeof(*header) ) return -1;
+    if( ( header->side != 'A' && header->side != 'B' ) ||
+        header_data_bytes( header ) != header->data_bytes ) return -1;
+    return 1;
+}
+
+int mm_packed_save(const mm_packed *packed, const char *path)
+{
+    if( !packed || !path ) return -1;
+
+    mm_file_header header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, MM_FILE_MAGIC, sizeof(header.magic) );
+    header.version = MM_FILE_VERSION;
+    header.data_offset = MM_FILE_DATA_OFFSET;
+    header.dtype = packed->dtype;
+    header.side = packed->side;
+    header.leaf_size = packed->leaf_size;
+    header.rows = packed->rows;
+    header.cols = packed->cols;
+    header.data_bytes = header_data_bytes( &header );
+    header.checksum = mm_file_checksum( packed->data, header.data_bytes );
+
+    FILE *file = fopen( path, "wb" );
+    if( !file ) return -1;
+
+    // the header, zero padded up to the data
+    char *page = (char *) calloc( 1, MM_FILE_DATA_OFFSET );
+    int failed = !page;
+    if( page )
+    {
+        memcpy( page, &header, sizeof(header) );
+        failed = fwrite( page, 1, MM_FILE_DATA_OFFSET, file ) != MM_FILE_DATA_OFFSET ||
+                 fwrite( packed->data, 1, header.data_bytes, file ) != header.data_bytes;
+        free( page );
+    }
+    if( fclose( file ) ) failed = 1;
+    return failed ? -1 : 0;
+}
+
+// the occupancy of a mapped operand's tiles, 0 for an unknown type or when out of memory
+static uint32_t *file_occupancy( const mm_packed *packed )
+{
+    int bs = packed->leaf_size;
+    size_t tiles = (size_t)( ( packed->rows + bs - 1 ) / bs ) * ( ( packed->cols + bs - 1 ) / bs );
+    uint32_t *occupancy = (uint32_t *) malloc( ( tiles + 1 ) * sizeof(uint32_t) );
+    if( !occupancy ) return 0;
+
+    switch( packed->dtype )
+    {
+    case MM_FLOAT32: mm_occupancy_flags( (const float *) packed->data, tiles, bs, occupancy ); break;
+    case MM_FLOAT64: mm_occupancy_flags( (const double *) packed->data, tiles, bs, occupancy ); break;
+    case MM_INT8: mm_occupancy_flags( (const int8_t *) packed->data, tiles, bs, occupancy ); break;
+    case MM_COMPLEX64: mm_occupancy_flags( (const std::complex<float> *) packed->data, tiles, bs, occupancy ); break;
+    case MM_COMPLEX128: mm_occupancy_flags( (const std::complex<double> *) packed->data, tiles, bs, occupancy ); break;
+    default:
+        free( occupancy );
+        return 0;
+    }
+    mm_occupancy_counts( occupancy, tiles );
+    return occupancy;
+}
+
+mm_packed *mm_packed_map(const char *path, int check)
+{
+    mm_file_header header;
+    if( !path || mm_file_read_header( path, &header ) != 1 ) return 0;
+
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) return 0;
+    struct stat st;
+    size_t mapped = (size_t) header.data_offset + header.data_bytes;
+    void *map = MAP_FAILED;
+    if( !fstat( fd, &st ) && (size_t) st.st_size >= mapped )
+        map = mmap( 0, mapped, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( map == MAP_FAILED ) return 0;
+
+    char *data = (char *) map + header.data_offset;
+    mm_packed *packed = (mm_packed *) malloc( sizeof(mm_packed) );
+    if( !packed || ( check && mm_file_checksum( data, header.data_bytes ) != header.checksum ) )
+    {
+        free( packed );
+        munmap( map, mapped );
+        return 0;
+    }
+
+    packed->side = (char) header.side;
+    packed->dtype = (mm_dtype) header.dtype;
+    packed->rows = (int) header.rows;
+    packed->cols = (int) header.cols;
+    packed->leaf_size = (int) header.leaf_size;
+    packed->data = data;
+    packed->map = map;
+    packed->mapped = mapped;
+    // scanned once here rather than by every multiply; without it they scan
+    packed->occupancy = file_occupancy( packed );
+    return packed;
+}
+
+void mm_packed_info(const mm_packed *packed, char *side, mm_dtype *dtype, int *rows, int *cols,
+                    int *leaf_size)
+{
+    if( side ) *side = packed->side;
+    if( dtype ) *dtype = packed->dtype;
+    if( rows ) *rows = packed->rows;
+    if( cols ) *cols = packed->cols;
+    if( leaf_size ) *leaf_size = packed->leaf_size;
+}
+
+const void *mm_packed_data(const mm_packed *packed)
+{
+    return packed->data;
+}
@@ -0,0 +1,730 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MM_KERNEL_X86 1
+#endif
+
+#include "mm_kernel.h"
+
+/*
+ * Portable fallback: each C element is a dot product of a row of A with a
+ * row of the (transposed) B tile.
+ */
+template <typename T>
+static void mm_morton_base( typename mm_types<T>::acc *C, const T *A, const T *B, int block_size )
+{
+    typedef typename mm_types<T>::acc acc_t;
+    int a_index = 0;
+    int b_index = 0;
+    acc_t s = acc_t();
+
+    // for every row in matrix A
+    for( int i = 0; i < block_size; ++i )
+    {
+        // for each column in matrix B
+        b_index = 0;
+        for( int j = 0; j < block_size; ++j )
+        {
+            s = acc_t();
+            for( int k = 0; k < block_size; ++k )
+            {
+                s += acc_t( A[ a_index + k ] ) * acc_t( B[ b_index + k ] );
+            }
+            C[a_index + j] += s;
+            b_index += block_size;
+        }
+        a_index += block_size;
+    }
+}
+
+/*
+ * mm_mixed: the lanes of each dot product are summed in float, exactly as
+ * the AVX2 kernel below does, and added together in double.
+ */
+template <>
+void mm_morton_base<mm_mixed>( double *C, const mm_mixed *A, const mm_mixed *B, int block_size )
+{
+    const int bs = block_size;
+    const float *a = (const float *) A;
+    const float *b = (const float *) B;
+
+    for( int i = 0; i < bs; ++i )
+    {
+        for( int j = 0; j < bs; ++j )
+        {
+            float lane[MM_MIXED_LANES] = { 0.0f };
+            for( int k0 = 0; k0 < bs; k0 += MM_MIXED_LANES )
+                for( int l = 0; l < MM_MIXED_LANES && k0 + l < bs; ++l )
+                    lane[l] += a[i * bs + k0 + l] * b[j * bs + k0 + l];
+
+            double s = 0.0;
+            for( int l = 0; l < MM_MIXED_LANES; ++l )
+                s += lane[l];
+            C[i * bs + j] += s;
+        }
+    }
+}
+
+// portable row kernel, one dot product per column of B
+template <typename T>
+static void mm_row_base( typename mm_types<T>::acc *c, const T *a, const T *b, int ldb, int len, int n )
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    for( int j = 0; j < n; ++j )
+    {
+        const T *bj = b + (size_t) j * ldb;
+        acc_t s = acc_t();
+        for( int p = 0; p < len; ++p )
+            s += acc_t( a[p] ) * acc_t( bj[p] );
+        c[j] += s;
+    }
+}
+
+#ifdef MM_KERNEL_X86
+
+/*
+ * Reduce four accumulators to one vector holding their horizontal sums,
+ * i.e. { sum(v0), sum(v1), sum(v2), sum(v3) }.
+ */
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256d hsum4_pd( __m256d v0, __m256d v1, __m256d v2, __m256d v3 )
+{
+    __m256d t0 = _mm256_hadd_pd( v0, v1 );
+    __m256d t1 = _mm256_hadd_pd( v2, v3 );
+    __m256d lo = _mm256_permute2f128_pd( t0, t1, 0x20 );
+    __m256d hi = _mm256_permute2f128_pd( t0, t1, 0x31 );
+    return _mm256_add_pd( lo, hi );
+}
+
+/*
+ * AVX2/FMA kernel with a 2x4 register block of C.  Two rows of A and four
+ * rows of the transposed B tile are streamed four k values at a time; the
+ * eight partial dot products stay in registers until the k loop ends.
+ * Requires block_size % 4 == 0.
+ */
+__attribute__((target("avx2,fma")))
+static void mm_kernel_avx2_f64( double *C, const double *A, const double *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 2 )
+    {
+        const double *a0 = A + i * bs;
+        const double *a1 = a0 + bs;
+        double *c0 = C + i * bs;
+        double *c1 = c0 + bs;
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const double *b0 = B + j * bs;
+            const double *b1 = b0 + bs;
+            const double *b2 = b1 + bs;
+            const double *b3 = b2 + bs;
+
+            __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+            __m256d c02 = _mm256_setzero_pd(), c03 = _mm256_setzero_pd();
+            __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+            __m256d c12 = _mm256_setzero_pd(), c13 = _mm256_setzero_pd();
+
+            for( int k = 0; k < bs; k += 4 )
+            {
+                __m256d av0 = _mm256_loadu_pd( a0 + k );
+                __m256d av1 = _mm256_loadu_pd( a1 + k );
+                __m256d bv;
+
+                bv = _mm256_loadu_pd( b0 + k );
+                c00 = _mm256_fmadd_pd( av0, bv, c00 );
+                c10 = _mm256_fmadd_pd( av1, bv, c10 );
+                bv = _mm256_loadu_pd( b1 + k );
+                c01 = _mm256_fmadd_pd( av0, bv, c01 );
+                c11 = _mm256_fmadd_pd( av1, bv, c11 );
+                bv = _mm256_loadu_pd( b2 + k );
+                c02 = _mm256_fmadd_pd( av0, bv, c02 );
+                c12 = _mm256_fmadd_pd( av1, bv, c12 );
+                bv = _mm256_loadu_pd( b3 + k );
+                c03 = _mm256_fmadd_pd( av0, bv, c03 );
+                c13 = _mm256_fmadd_pd( av1, bv, c13 );
+            }
+
+            _mm256_storeu_pd( c0 + j, _mm256_add_pd( _mm256_loadu_pd( c0 + j ), hsum4_pd( c00, c01, c02, c03 ) ) );
+            _mm256_storeu_pd( c1 + j, _mm256_add_pd( _mm256_loadu_pd( c1 + j ), hsum4_pd( c10, c11, c12, c13 ) ) );
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx2,fma"), always_inline))
+static inline __m256d fold_pd( __m512d v )
+{
+    return _mm256_add_pd( _mm512_castpd512_pd256( v ), _mm512_extractf64x4_pd( v, 1 ) );
+}
+
+/*
+ * AVX-512 kernel with a 4x4 register block of C (16 zmm accumulators),
+ * streaming eight k values per step.  Requires block_size % 8 == 0.
+ */
+__attribute__((target("avx512f,avx2,fma")))
+static void mm_kernel_avx512_f64( double *C, const double *A, const double *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 4 )
+    {
+        const double *a0 = A + i * bs;
+        const double *a1 = a0 + bs;
+        const double *a2 = a1 + bs;
+        const double *a3 = a2 + bs;
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const double *b0 = B + j * bs;
+            const double *b1 = b0 + bs;
+            const double *b2 = b1 + bs;
+            const double *b3 = b2 + bs;
+
+            __m512d acc[4][4];
+            for( int r = 0; r < 4; ++r )
+                for( int c = 0; c < 4; ++c )
+                    acc[r][c] = _mm512_setzero_pd();
+
+            for( int k = 0; k < bs; k += 8 )
+            {
+                __m512d bv0 = _mm512_loadu_pd( b0 + k );
+                __m512d bv1 = _mm512_loadu_pd( b1 + k );
+                __m512d bv2 = _mm512_loadu_pd( b2 + k );
+                __m512d bv3 = _mm512_loadu_pd( b3 + k );
+                const double *arow[4] = { a0, a1, a2, a3 };
+
+                for( int r = 0; r < 4; ++r )
+                {
+                    __m512d av = _mm512_loadu_pd( arow[r] + k );
+                    acc[r][0] = _mm512_fmadd_pd( av, bv0, acc[r][0] );
+                    acc[r][1] = _mm512_fmadd_pd( av, bv1, acc[r][1] );
+                    acc[r][2] = _mm512_fmadd_pd( av, bv2, acc[r][2] );
+                    acc[r][3] = _mm512_fmadd_pd( av, bv3, acc[r][3] );
+                }
+            }
+
+            for( int r = 0; r < 4; ++r )
+            {
+                double *c = C + (i + r) * bs + j;
+                __m256d s = hsum4_pd( fold_pd( acc[r][0] ), fold_pd( acc[r][1] ),
+                                      fold_pd( acc[r][2] ), fold_pd( acc[r][3] ) );
+                _mm256_storeu_pd( c, _mm256_add_pd( _mm256_loadu_pd( c ), s ) );
+            }
+        }
+    }
+}
+
+/*
+ * Single precision versions of the two kernels above: eight floats per
+ * AVX2 vector (block_size % 8 == 0) and sixteen per AVX-512 vector
+ * (block_size % 16 == 0), with the same register blocking.
+ */
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m128 hsum4_ps( __m256 v0, __m256 v1, __m256 v2, __m256 v3 )
+{
+    __m256 t0 = _mm256_hadd_ps( v0, v1 );
+    __m256 t1 = _mm256_hadd_ps( v2, v3 );
+    __m256 t2 = _mm256_hadd_ps( t0, t1 );
+    return _mm_add_ps( _mm256_castps256_ps128( t2 ), _mm256_extractf128_ps( t2, 1 ) );
+}
+
+__attribute__((target("avx2,fma")))
+static void mm_kernel_avx2_f32( float *C, const float *A, const float *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 2 )
+    {
+        const float *a0 = A + i * bs;
+        const float *a1 = a0 + bs;
+        float *c0 = C + i * bs;
+        float *c1 = c0 + bs;
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const float *b0 = B + j * bs;
+            const float *b1 = b0 + bs;
+            const float *b2 = b1 + bs;
+            const float *b3 = b2 + bs;
+
+            __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+            __m256 c02 = _mm256_setzero_ps(), c03 = _mm256_setzero_ps();
+            __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+            __m256 c12 = _mm256_setzero_ps(), c13 = _mm256_setzero_ps();
+
+            for( int k = 0; k < bs; k += 8 )
+            {
+                __m256 av0 = _mm256_loadu_ps( a0 + k );
+                __m256 av1 = _mm256_loadu_ps( a1 + k );
+                __m256 bv;
+
+                bv = _mm256_loadu_ps( b0 + k );
+                c00 = _mm256_fmadd_ps( av0, bv, c00 );
+                c10 = _mm256_fmadd_ps( av1, bv, c10 );
+                bv = _mm256_loadu_ps( b1 + k );
+                c01 = _mm256_fmadd_ps( av0, bv, c01 );
+                c11 = _mm256_fmadd_ps( av1, bv, c11 );
+                bv = _mm256_loadu_ps( b2 + k );
+                c02 = _mm256_fmadd_ps( av0, bv, c02 );
+                c12 = _mm256_fmadd_ps( av1, bv, c12 );
+                bv = _mm256_loadu_ps( b3 + k );
+                c03 = _mm256_fmadd_ps( av0, bv, c03 );
+                c13 = _mm256_fmadd_ps( av1, bv, c13 );
+            }
+
+            _mm_storeu_ps( c0 + j, _mm_add_ps( _mm_loadu_ps( c0 + j ), hsum4_ps( c00, c01, c02, c03 ) ) );
+            _mm_storeu_ps( c1 + j, _mm_add_ps( _mm_loadu_ps( c1 + j ), hsum4_ps( c10, c11, c12, c13 ) ) );
+        }
+    }
+}
+
+// the eight float lanes of v summed pairwise in double, { v0 + v4, v1 + v5, v2 + v6, v3 + v7 }
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256d widen_pd( __m256 v )
+{
+    return _mm256_add_pd( _mm256_cvtps_pd( _mm256_castps256_ps128( v ) ),
+                          _mm256_cvtps_pd( _mm256_extractf128_ps( v, 1 ) ) );
+}
+
+/*
+ * mm_mixed version of the float kernel: the same loop, with the eight lanes
+ * of each accumulator reduced in double and added to a double C.
+ */
+__attribute__((target("avx2,fma")))
+static void mm_kernel_avx2_mixed( double *C, const mm_mixed *A, const mm_mixed *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 2 )
+    {
+        const float *a0 = (const float *) A + i * bs;
+        const float *a1 = a0 + bs;
+        double *c0 = C + i * bs;
+        double *c1 = c0 + bs;
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const float *b0 = (const float *) B + j * bs;
+            const float *b1 = b0 + bs;
+            const float *b2 = b1 + bs;
+            const float *b3 = b2 + bs;
+
+            __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+            __m256 c02 = _mm256_setzero_ps(), c03 = _mm256_setzero_ps();
+            __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+            __m256 c12 = _mm256_setzero_ps(), c13 = _mm256_setzero_ps();
+
+            for( int k = 0; k < bs; k += 8 )
+            {
+                __m256 av0 = _mm256_loadu_ps( a0 + k );
+                __m256 av1 = _mm256_loadu_ps( a1 + k );
+                __m256 bv;
+
+                bv = _mm256_loadu_ps( b0 + k );
+                c00 = _mm256_fmadd_ps( av0, bv, c00 );
+                c10 = _mm256_fmadd_ps( av1, bv, c10 );
+                bv = _mm256_loadu_ps( b1 + k );
+                c01 = _mm256_fmadd_ps( av0, bv, c01 );
+                c11 = _mm256_fmadd_ps( av1, bv, c11 );
+                bv = _mm256_loadu_ps( b2 + k );
+                c02 = _mm256_fmadd_ps( av0, bv, c02 );
+                c12 = _mm256_fmadd_ps( av1, bv, c12 );
+                bv = _mm256_loadu_ps( b3 + k );
+                c03 = _mm256_fmadd_ps( av0, bv, c03 );
+                c13 = _mm256_fmadd_ps( av1, bv, c13 );
+            }
+
+            __m256d s0 = hsum4_pd( widen_pd( c00 ), widen_pd( c01 ), widen_pd( c02 ), widen_pd( c03 ) );
+            __m256d s1 = hsum4_pd( widen_pd( c10 ), widen_pd( c11 ), widen_pd( c12 ), widen_pd( c13 ) );
+            _mm256_storeu_pd( c0 + j, _mm256_add_pd( _mm256_loadu_pd( c0 + j ), s0 ) );
+            _mm256_storeu_pd( c1 + j, _mm256_add_pd( _mm256_loadu_pd( c1 + j ), s1 ) );
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx2,fma"), always_inline))
+static inline __m256 fold_ps( __m512 v )
+{
+    __m256 hi = _mm256_castpd_ps( _mm512_extractf64x4_pd( _mm512_castps_pd( v ), 1 ) );
+    return _mm256_add_ps( _mm512_castps512_ps256( v ), hi );
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void mm_kernel_avx512_f32( float *C, const float *A, const float *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 4 )
+    {
+        const float *arow[4] = { A + i * bs, A + (i + 1) * bs, A + (i + 2) * bs, A + (i + 3) * bs };
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const float *b0 = B + j * bs;
+            const float *b1 = b0 + bs;
+            const float *b2 = b1 + bs;
+            const float *b3 = b2 + bs;
+
+            __m512 acc[4][4];
+            for( int r = 0; r < 4; ++r )
+                for( int c = 0; c < 4; ++c )
+                    acc[r][c] = _mm512_setzero_ps();
+
+            for( int k = 0; k < bs; k += 16 )
+            {
+                __m512 bv0 = _mm512_loadu_ps( b0 + k );
+                __m512 bv1 = _mm512_loadu_ps( b1 + k );
+                __m512 bv2 = _mm512_loadu_ps( b2 + k );
+                __m512 bv3 = _mm512_loadu_ps( b3 + k );
+
+                for( int r = 0; r < 4; ++r )
+                {
+                    __m512 av = _mm512_loadu_ps( arow[r] + k );
+                    acc[r][0] = _mm512_fmadd_ps( av, bv0, acc[r][0] );
+                    acc[r][1] = _mm512_fmadd_ps( av, bv1, acc[r][1] );
+                    acc[r][2] = _mm512_fmadd_ps( av, bv2, acc[r][2] );
+                    acc[r][3] = _mm512_fmadd_ps( av, bv3, acc[r][3] );
+                }
+            }
+
+            for( int r = 0; r < 4; ++r )
+            {
+                float *c = C + (i + r) * bs + j;
+                __m128 s = hsum4_ps( fold_ps( acc[r][0] ), fold_ps( acc[r][1] ),
+                                     fold_ps( acc[r][2] ), fold_ps( acc[r][3] ) );
+                _mm_storeu_ps( c, _mm_add_ps( _mm_loadu_ps( c ), s ) );
+            }
+        }
+    }
+}
+
+/*
+ * AVX2/FMA row kernels.  The row of A is loaded once per four columns of B,
+ * which are streamed against it as in the leaf kernels; a last column on
+ * its own keeps four accumulators so that a matrix-vector product is not
+ * bound by the FMA latency.  Any len, tails are scalar.
+ */
+__attribute__((target("avx2,fma")))
+static void mm_row_avx2_f64( double *c, const double *a, const double *b, int ldb, int len, int n )
+{
+    int j = 0;
+    for( ; j + 4 <= n; j += 4 )
+    {
+        const double *b0 = b + (size_t) j * ldb;
+        const double *b1 = b0 + ldb;
+        const double *b2 = b1 + ldb;
+        const double *b3 = b2 + ldb;
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+
+        int p = 0;
+        for( ; p + 4 <= len; p += 4 )
+        {
+            __m256d av = _mm256_loadu_pd( a + p );
+            s0 = _mm256_fmadd_pd( av, _mm256_loadu_pd( b0 + p ), s0 );
+            s1 = _mm256_fmadd_pd( av, _mm256_loadu_pd( b1 + p ), s1 );
+            s2 = _mm256_fmadd_pd( av, _mm256_loadu_pd( b2 + p ), s2 );
+            s3 = _mm256_fmadd_pd( av, _mm256_loadu_pd( b3 + p ), s3 );
+        }
+
+        double t[4];
+        _mm256_storeu_pd( t, hsum4_pd( s0, s1, s2, s3 ) );
+        for( ; p < len; p++ )
+        {
+            t[0] += a[p] * b0[p];
+            t[1] += a[p] * b1[p];
+            t[2] += a[p] * b2[p];
+            t[3] += a[p] * b3[p];
+        }
+        for( int q = 0; q < 4; q++ )
+            c[j + q] += t[q];
+    }
+
+    for( ; j < n; j++ )
+    {
+        const double *bj = b + (size_t) j * ldb;
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+
+        int p = 0;
+        for( ; p + 16 <= len; p += 16 )
+        {
+            s0 = _mm256_fmadd_pd( _mm256_loadu_pd( a + p ), _mm256_loadu_pd( bj + p ), s0 );
+            s1 = _mm256_fmadd_pd( _mm256_loadu_pd( a + p + 4 ), _mm256_loadu_pd( bj + p + 4 ), s1 );
+            s2 = _mm256_fmadd_pd( _mm256_loadu_pd( a + p + 8 ), _mm256_loadu_pd( bj + p + 8 ), s2 );
+            s3 = _mm256_fmadd_pd( _mm256_loadu_pd( a + p + 12 ), _mm256_loadu_pd( bj + p + 12 ), s3 );
+        }
+        for( ; p + 4 <= len; p += 4 )
+            s0 = _mm256_fmadd_pd( _mm256_loadu_pd( a + p ), _mm256_loadu_pd( bj + p ), s0 );
+
+        double t[4];
+        _mm256_storeu_pd( t, hsum4_pd( s0, s1, s2, s3 ) );
+        double s = t[0] + t[1] + t[2] + t[3];
+        for( ; p < len; p++ )
+            s += a[p] * bj[p];
+        c[j] += s;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mm_row_avx2_f32( float *c, const float *a, const float *b, int ldb, int len, int n )
+{
+    int j = 0;
+    for( ; j + 4 <= n; j += 4 )
+    {
+        const float *b0 = b + (size_t) j * ldb;
+        const float *b1 = b0 + ldb;
+        const float *b2 = b1 + ldb;
+        const float *b3 = b2 + ldb;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+        int p = 0;
+        for( ; p + 8 <= len; p += 8 )
+        {
+            __m256 av = _mm256_loadu_ps( a + p );
+            s0 = _mm256_fmadd_ps( av, _mm256_loadu_ps( b0 + p ), s0 );
+            s1 = _mm256_fmadd_ps( av, _mm256_loadu_ps( b1 + p ), s1 );
+            s2 = _mm256_fmadd_ps( av, _mm256_loadu_ps( b2 + p ), s2 );
+            s3 = _mm256_fmadd_ps( av, _mm256_loadu_ps( b3 + p ), s3 );
+        }
+
+        float t[4];
+        _mm_storeu_ps( t, hsum4_ps( s0, s1, s2, s3 ) );
+        for( ; p < len; p++ )
+        {
+            t[0] += a[p] * b0[p];
+            t[1] += a[p] * b1[p];
+            t[2] += a[p] * b2[p];
+            t[3] += a[p] * b3[p];
+        }
+        for( int q = 0; q < 4; q++ )
+            c[j + q] += t[q];
+    }
+
+    for( ; j < n; j++ )
+    {
+        const float *bj = b + (size_t) j * ldb;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+        int p = 0;
+        for( ; p + 32 <= len; p += 32 )
+        {
+            s0 = _mm256_fmadd_ps( _mm256_loadu_ps( a + p ), _mm256_loadu_ps( bj + p ), s0 );
+            s1 = _mm256_fmadd_ps( _mm256_loadu_ps( a + p + 8 ), _mm256_loadu_ps( bj + p + 8 ), s1 );
+            s2 = _mm256_fmadd_ps( _mm256_loadu_ps( a + p + 16 ), _mm256_loadu_ps( bj + p + 16 ), s2 );
+            s3 = _mm256_fmadd_ps( _mm256_loadu_ps( a + p + 24 ), _mm256_loadu_ps( bj + p + 24 ), s3 );
+        }
+        for( ; p + 8 <= len; p += 8 )
+            s0 = _mm256_fmadd_ps( _mm256_loadu_ps( a + p ), _mm256_loadu_ps( bj + p ), s0 );
+
+        float t[4];
+        _mm_storeu_ps( t, hsum4_ps( s0, s1, s2, s3 ) );
+        float s = t[0] + t[1] + t[2] + t[3];
+        for( ; p < len; p++ )
+            s += a[p] * bj[p];
+        c[j] += s;
+    }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m128i hsum4_epi32( __m128i v0, __m128i v1, __m128i v2, __m128i v3 )
+{
+    return _mm_hadd_epi32( _mm_hadd_epi32( v0, v1 ), _mm_hadd_epi32( v2, v3 ) );
+}
+
+/*
+ * int8 kernel accumulating into int32.  Eight k values of A and B are
+ * widened to int16 and combined pairwise with madd, which cannot overflow
+ * (2 * 128 * 128 fits easily in int32).  2x4 register block of C as in the
+ * float kernels.  Requires block_size % 8 == 0.
+ */
+__attribute__((target("avx2")))
+static void mm_kernel_avx2_i8( int32_t *C, const int8_t *A, const int8_t *B, int block_size )
+{
+    const int bs = block_size;
+
+    for( int i = 0; i < bs; i += 2 )
+    {
+        const int8_t *a0 = A + i * bs;
+        const int8_t *a1 = a0 + bs;
+        int32_t *c0 = C + i * bs;
+        int32_t *c1 = c0 + bs;
+
+        for( int j = 0; j < bs; j += 4 )
+        {
+            const int8_t *brow[4] = { B + j * bs, B + (j + 1) * bs, B + (j + 2) * bs, B + (j + 3) * bs };
+            __m128i acc0[4], acc1[4];
+            for( int c = 0; c < 4; ++c )
+            {
+                acc0[c] = _mm_setzero_si128();
+                acc1[c] = _mm_setzero_si128();
+            }
+
+            for( int k = 0; k < bs; k += 8 )
+            {
+                __m128i av0 = _mm_cvtepi8_epi16( _mm_loadl_epi64( (const __m128i *)( a0 + k ) ) );
+                __m128i av1 = _mm_cvtepi8_epi16( _mm_loadl_epi64( (const __m128i *)( a1 + k ) ) );
+
+                for( int c = 0; c < 4; ++c )
+                {
+                    __m128i bv = _mm_cvtepi8_epi16( _mm_loadl_epi64( (const __m128i *)( brow[c] + k ) ) );
+                    acc0[c] = _mm_add_epi32( acc0[c], _mm_madd_epi16( av0, bv ) );
+                    acc1[c] = _mm_add_epi32( acc1[c], _mm_madd_epi16( av1, bv ) );
+                }
+            }
+
+            __m128i s0 = hsum4_epi32( acc0[0], acc0[1], acc0[2], acc0[3] );
+            __m128i s1 = hsum4_epi32( acc1[0], acc1[1], acc1[2], acc1[3] );
+            _mm_storeu_si128( (__m128i *)( c0 + j ), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)( c0 + j ) ), s0 ) );
+            _mm_storeu_si128( (__m128i *)( c1 + j ), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)( c1 + j ) ), s1 ) );
+        }
+    }
+}
+
+#endif  // MM_KERNEL_X86
+
+/*
+ * The SIMD kernels available for each element type.  Each returns 0 when
+ * the type has no such kernel or the leaf size does not fit it.  unforced
+ * is set when the caller did not ask for the kernel by name; with a single
+ * k step per leaf the AVX-512 reductions dominate, so it is then only
+ * picked for leaves at least two vectors wide.
+ */
+template <typename T>
+static typename mm_kernel<T>::fn avx2_kernel( const T *, int ) { return 0; }
+template <typename T>
+static typename mm_kernel<T>::fn avx512_kernel( const T *, int, int ) { return 0; }
+
+#ifdef MM_KERNEL_X86
+static mm_kernel<double>::fn avx2_kernel( const double *, int block_size )
+{
+    return block_size % 4 == 0 ? mm_kernel_avx2_f64 : 0;
+}
+
+static mm_kernel<double>::fn avx512_kernel( const double *, int block_size, int unforced )
+{
+    return block_size % 8 == 0 && ( !unforced || block_size >= 16 ) ? mm_kernel_avx512_f64 : 0;
+}
+
+static mm_kernel<float>::fn avx2_kernel( const float *, int block_size )
+{
+    return block_size % 8 == 0 ? mm_kernel_avx2_f32 : 0;
+}
+
+static mm_kernel<float>::fn avx512_kernel( const float *, int block_size, int unforced )
+{
+    return block_size % 16 == 0 && ( !unforced || block_size >= 32 ) ? mm_kernel_avx512_f32 : 0;
+}
+
+static mm_kernel<int8_t>::fn avx2_kernel( const int8_t *, int block_size )
+{
+    return block_size % 8 == 0 ? mm_kernel_avx2_i8 : 0;
+}
+
+static mm_kernel<mm_mixed>::fn avx2_kernel( const mm_mixed *, int block_size )
+{
+    return block_size % MM_MIXED_LANES == 0 ? mm_kernel_avx2_mixed : 0;
+}
+#endif  // MM_KERNEL_X86
+
+// the row kernels stop at AVX2, as their loads outweigh the FMAs
+template <typename T>
+static typename mm_row_kernel<T>::fn avx2_row_kernel( const T * ) { return 0; }
+
+#ifdef MM_KERNEL_X86
+static mm_row_kernel<double>::fn avx2_row_kernel( const double * ) { return mm_row_avx2_f64; }
+static mm_row_kernel<float>::fn avx2_row_kernel( const float * ) { return mm_row_avx2_f32; }
+#endif  // MM_KERNEL_X86
+
+template <typename T>
+typename mm_kernel<T>::fn mm_kernel_select(int block_size, const char *force, const char **name)
+{
+    typename mm_kernel<T>::fn kernel = mm_morton_base<T>;
+    const char *kname = "scalar";
+
+#ifdef MM_KERNEL_X86
+    __builtin_cpu_init();
+    int has_avx2   = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    int has_avx512 = has_avx2 && __builtin_cpu_supports("avx512f");
+    typename mm_kernel<T>::fn k512 = 0, k256 = 0;
+
+    if( has_avx512 && ( !force || !strcmp(force, "avx512") ) )
+        k512 = avx512_kernel( (const T *) 0, block_size, !force );
+    if( has_avx2 && ( !force || !strcmp(force, "avx2") ) )
+        k256 = avx2_kernel( (const T *) 0, block_size );
+
+    if( k512 ) {
+        kernel = k512;
+        kname = "avx512";
+    } else if( k256 ) {
+        kernel = k256;
+        kname = "avx2";
+    }
+#endif
+
+    if( name ) *name = kname;
+    return kernel;
+}
+
+template mm_kernel<float>::fn mm_kernel_select<float>(int, const char *, const char **);
+template mm_kernel<double>::fn mm_kernel_select<double>(int, const char *, const char **);
+template mm_kernel<int8_t>::fn mm_kernel_select<int8_t>(int, const char *, const char **);
+template mm_kernel< std::complex<float> >::fn mm_kernel_select< std::complex<float> >(int, const char *, const char **);
+template mm_kernel< std::complex<double> >::fn mm_kernel_select< std::complex<double> >(int, const char *, const char **);
+template mm_kernel<mm_mixed>::fn mm_kernel_select<mm_mixed>(int, const char *, const char **);
+
+template <typename T>
+typename mm_row_kernel<T>::fn mm_row_kernel_select(const char *force, const char **name)
+{
+    typename mm_row_kernel<T>::fn kernel = mm_row_base<T>;
+    const char *kname = "scalar";
+
+#ifdef MM_KERNEL_X86
+    __builtin_cpu_init();
+    int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    typename mm_row_kernel<T>::fn k256 = 0;
+
+    if( has_avx2 && ( !force || strcmp(force, "scalar") ) )
+        k256 = avx2_row_kernel( (const T *) 0 );
+    if( k256 ) {
+        kernel = k256;
+        kname = "avx2";
+    }
+#endif
+
+    if( name ) *name = kname;
+    return kernel;
+}
+
+template mm_row_kernel<float>::fn mm_row_kernel_select<float>(const char *, const char **);
+template mm_row_kernel<double>::fn mm_row_kernel_select<double>(const char *, const char **);
+template mm_row_kernel<int8_t>::fn mm_row_kernel_select<int8_t>(const char *, const char **);
+template mm_row_kernel< std::complex<float> >::fn mm_row_kernel_select< std::complex<float> >(const char *, const char **);
+template mm_row_kernel< std::complex<double> >::fn mm_row_kernel_select< std::complex<double> >(const char *, const char **);
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_KERNEL_H_
+#define _MM_KERNEL_H_
+
+#include "mm_dac.h"
+
+/*
+ * Leaf kernels for the Morton-Z recursion.  Every kernel computes
+ * C += A * B on one block_size x block_size leaf, where A and C are the
+ * row-major tiles produced by transformMatrixA / extractResults and B is
+ * the column-major tile produced by transformMatrixB.  C holds the
+ * accumulator type of T.
+ */
+/*
+ * Operand type of mm_dgemm_mixed: a float, laid out as one, that the
+ * kernels multiply in single precision and accumulate into double.  Within
+ * a leaf every MM_MIXED_LANES-th k of a dot product goes to the same float
+ * partial sum, and the partial sums are added up in double, so a lane sums
+ * at most block_size / MM_MIXED_LANES products in float.
+ */
+#define MM_MIXED_LANES 8
+
+struct mm_mixed {
+    float x;
+    mm_mixed() {}
+    mm_mixed(double v) : x( (float) v ) {}
+    operator double() const { return x; }
+};
+
+template <> struct mm_types<mm_mixed> {
+    typedef double acc;
+    static const mm_dtype dtype = MM_FLOAT32;
+};
+
+template <typename T>
+struct mm_kernel {
+    typedef void (*fn)(typename mm_types<T>::acc *C, const T *A, const T *B, int block_size);
+};
+
+/*
+ * Pick the fastest kernel for T the host CPU supports for the given leaf
+ * size.  force may name a specific kernel ("scalar", "avx2", "avx512") or
+ * be 0.  The chosen kernel's name is stored in *name when name is non-zero.
+ * Defined for every element type listed in mm_dac.h.
+ */
+template <typename T>
+typename mm_kernel<T>::fn mm_kernel_select(int block_size, const char *force, const char **name);
+
+/*
+ * Row kernels of the skinny path: c[j] += sum over p < len of
+ * a[p] * b[j * ldb + p] for j < n, i.e. one row of A against n columns of
+ * B that are each stored contiguously.  n is at most MM_SKINNY_MAX.
+ */
+template <typename T>
+struct mm_row_kernel {
+    typedef void (*fn)(typename mm_types<T>::acc *c, const T *a, const T *b, int ldb, int len, int n);
+};
+
+/*
+ * The fastest row kernel for T on the host CPU; force "scalar" keeps the
+ * portable one, any other name the best available.
+ */
+template <typename T>
+typename mm_row_kernel<T>::fn mm_row_kernel_select(const char *force, const char **name);
+
+#endif  // _MM_KERNEL_H_
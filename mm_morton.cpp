@@ -0,0 +1,1633 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "mm_dac.h"
+#include "mm_kernel.h"
+#include "mm_numa.h"
+#include "mm_packed.h"
+#include "mm_parallel.h"
+#include "mm_workspace.h"
+
+// largest leaf tile width accepted in mm_options
+#define MAX_LEAF_SIZE 256
+
+// regions of at most this many tiles are converted without spawning
+#define CONVERT_GRAIN_TILES 16
+
+// kernel requested with mm_set_kernel; empty picks the best for each leaf size
+static char forced_kernel[16] = "";
+
+// process-wide settings, see mm_options in mm_dac.h
+static mm_options engine_options = { 0, 0, 0, 0, MM_NUMA_DEFAULT, 0, MM_HUGE_PAGES_TRANSPARENT, 0 };
+
+static int current_leaf_size(void) {
+    return engine_options.leaf_size > 0 ? engine_options.leaf_size : MM_DEFAULT_LEAF_SIZE;
+}
+
+// largest workspace the temporary-buffer recursion may take: half the free memory
+static size_t temp_budget(void) {
+    long pages = sysconf( _SC_AVPHYS_PAGES );
+    long page_size = sysconf( _SC_PAGESIZE );
+    if( pages <= 0 || page_size <= 0 ) return 0;
+    return (size_t)pages * page_size / 2;
+}
+
+static int current_spawn_grain(void) {
+    return engine_options.spawn_grain > 0 ? engine_options.spawn_grain : MM_DEFAULT_SPAWN_GRAIN;
+}
+
+/*
+ * Everything about a multiply that stays fixed during the recursion: the
+ * leaf kernel, the leaf tile width bs it was chosen for and the spawn grain
+ * in tiles.
+ */
+template <typename T>
+struct mul_args {
+    typename mm_kernel<T>::fn kernel;
+    int bs;
+    size_t tile;        // elements per leaf tile, bs * bs
+    int serial_tiles;   // sub-multiplies at most this many tiles wide run serially
+    // occupancy of the A and B buffers starting at a_base / b_base, see
+    // product_empty; 0 when every tile counts as occupied
+    const T *a_base;
+    const T *b_base;
+    const uint32_t *a_occupancy;
+    const uint32_t *b_occupancy;
+};
+
+// maps an accumulator type back to the operand type that produces it
+template <typename U> struct operand_of { typedef U type; };
+template <> struct operand_of<int32_t> { typedef int8_t type; };
+
+/*
+ * Matrices of any shape are stored as a grid of bs x bs leaf tiles, where
+ * bs is mm_options.leaf_size; edge tiles are zero padded.  A grid of t tiles
+ * along one dimension is split into a first half of (t + 1) / 2 tiles and a second half of the
+ * remaining t / 2, which is empty once t reaches 1.  Each quadrant is stored
+ * contiguously, so for a power-of-two n this is exactly the original
+ * Morton-Z layout.  Since A, B and C all halve their dimensions by the same
+ * rule, the quadrants of the three matrices always line up in mat_mul_par.
+ */
+static inline int split_tiles(int t) {
+    return (t + 1) >> 1;
+}
+
+static inline int num_tiles(int extent, int bs) {
+    return (extent + bs - 1) / bs;
+}
+
+static size_t morton_size(int rows, int cols, int bs) {
+    if( rows <= 0 || cols <= 0 ) return 0;
+    return (size_t)num_tiles( rows, bs ) * num_tiles( cols, bs ) * bs * bs;
+}
+
+/*
+ * The quadrants of A, B and C for one level of the recursion.  Index 0..3 is
+ * TL, TR, BL, BR for all three; the second row or column of tiles is empty
+ * when m1, k1 or n1 is 0.
+ */
+template <typename T>
+struct quadrants {
+    const T *A[4];
+    const T *B[4];
+    typename mm_types<T>::acc *C[4];
+    int m0, m1, k0, k1, n0, n1;
+};
+
+template <typename T>
+static inline void split_quadrants(quadrants<T> *q, const T *A, const T *B, typename mm_types<T>::acc *C,
+                                   int mt, int kt, int nt, size_t tile_size) {
+    q->m0 = split_tiles(mt); q->m1 = mt - q->m0;
+    q->k0 = split_tiles(kt); q->k1 = kt - q->k0;
+    q->n0 = split_tiles(nt); q->n1 = nt - q->n0;
+
+    //each sub-matrix points to the start of the z pattern
+    q->A[0] = &A[0];
+    q->A[1] = &A[(size_t)q->m0 * q->k0 * tile_size];
+    q->A[2] = &A[(size_t)q->m0 * kt * tile_size];
+    q->A[3] = &q->A[2][(size_t)q->m1 * q->k0 * tile_size];
+
+    //B is stored column-wise, so its TR quadrant follows BL
+    q->B[0] = &B[0];
+    q->B[1] = &B[(size_t)kt * q->n0 * tile_size];
+    q->B[2] = &B[(size_t)q->k0 * q->n0 * tile_size];
+    q->B[3] = &q->B[1][(size_t)q->k0 * q->n1 * tile_size];
+
+    q->C[0] = &C[0];
+    q->C[1] = &C[(size_t)q->m0 * q->n0 * tile_size];
+    q->C[2] = &C[(size_t)q->m0 * nt * tile_size];
+    q->C[3] = &q->C[2][(size_t)q->m1 * q->n0 * tile_size];
+}
+
+/*
+ * Occupancy of a Morton buffer: entry t counts the tiles before tile t (in
+ * storage order) that hold a nonzero element, and entry tiles the total.
+ * Every quadrant of the recursion is a contiguous run of tiles, so whether
+ * it is all zero is one difference of two entries, the same answer a
+ * quadtree of occupancy bits would give.
+ */
+static inline int tiles_empty(const uint32_t *occupancy, size_t first, size_t count) {
+    return occupancy[first + count] == occupancy[first];
+}
+
+// nonzero when the mt x kt tiles of A or the kt x nt tiles of B are all zero
+template <typename T>
+static inline int product_empty(const T *A, const T *B, int mt, int kt, int nt, const mul_args<T> *args) {
+    return ( args->a_occupancy &&
+             tiles_empty( args->a_occupancy, (size_t)( A - args->a_base ) / args->tile, (size_t)mt * kt ) ) ||
+           ( args->b_occupancy &&
+             tiles_empty( args->b_occupancy, (size_t)( B - args->b_base ) / args->tile, (size_t)kt * nt ) );
+}
+
+//serial recursion used below the spawn grain, same order as mat_mul_par
+template <typename T>
+static void mat_mul_serial(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                           const mul_args<T> *args) {
+
+    //an all-zero operand quadrant adds nothing to C
+    if(product_empty(A, B, mt, kt, nt, args)) return;
+
+    if(mt == 1 && kt == 1 && nt == 1) {
+        args->kernel( C, A, B, args->bs );
+        return;
+    }
+
+    quadrants<T> q;
+    split_quadrants(&q, A, B, C, mt, kt, nt, args->tile);
+
+    mat_mul_serial(q.A[0], q.B[0], q.C[0], q.m0, q.k0, q.n0, args);
+    if(q.k1) mat_mul_serial(q.A[1], q.B[2], q.C[0], q.m0, q.k1, q.n0, args);
+    if(q.n1) {
+        mat_mul_serial(q.A[0], q.B[1], q.C[1], q.m0, q.k0, q.n1, args);
+        if(q.k1) mat_mul_serial(q.A[1], q.B[3], q.C[1], q.m0, q.k1, q.n1, args);
+    }
+    if(q.m1) {
+        mat_mul_serial(q.A[2], q.B[0], q.C[2], q.m1, q.k0, q.n0, args);
+        if(q.k1) mat_mul_serial(q.A[3], q.B[2], q.C[2], q.m1, q.k1, q.n0, args);
+    }
+    if(q.m1 && q.n1) {
+        mat_mul_serial(q.A[2], q.B[1], q.C[3], q.m1, q.k0, q.n1, args);
+        if(q.k1) mat_mul_serial(q.A[3], q.B[3], q.C[3], q.m1, q.k1, q.n1, args);
+    }
+}
+
+//recursive parallel solution to matrix multiplication - row major order
+//C (mt x nt tiles) += A (mt x kt tiles) * B (kt x nt tiles)
+template <typename T>
+static void mat_mul_par(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                        const mul_args<T> *args) {
+
+    if(product_empty(A, B, mt, kt, nt, args)) return;
+
+    //below the spawn grain the tasks are too small to pay for their spawns
+    if(mt <= args->serial_tiles && kt <= args->serial_tiles && nt <= args->serial_tiles) {
+        mat_mul_serial(A, B, C, mt, kt, nt, args);
+        return;
+    }
+
+    quadrants<T> q;
+    split_quadrants(&q, A, B, C, mt, kt, nt, args->tile);
+
+    //recrusively call the sub-matrices for evaluation in parallel,
+    //skipping the products whose quadrants are empty
+    mm_parallel_invoke(
+        [&] { if(q.n1) mat_mul_par(q.A[0], q.B[1], q.C[1], q.m0, q.k0, q.n1, args); },
+        [&] { if(q.m1) mat_mul_par(q.A[2], q.B[0], q.C[2], q.m1, q.k0, q.n0, args); },
+        [&] { if(q.m1 && q.n1) mat_mul_par(q.A[2], q.B[1], q.C[3], q.m1, q.k0, q.n1, args); },
+        [&] { mat_mul_par(q.A[0], q.B[0], q.C[0], q.m0, q.k0, q.n0, args); });
+    //the first round has finished here
+
+    if(q.k1 == 0) return;
+
+    mm_parallel_invoke(
+        [&] { if(q.n1) mat_mul_par(q.A[1], q.B[3], q.C[1], q.m0, q.k1, q.n1, args); },
+        [&] { if(q.m1) mat_mul_par(q.A[3], q.B[2], q.C[2], q.m1, q.k1, q.n0, args); },
+        [&] { if(q.m1 && q.n1) mat_mul_par(q.A[3], q.B[3], q.C[3], q.m1, q.k1, q.n1, args); },
+        [&] { mat_mul_par(q.A[1], q.B[2], q.C[0], q.m0, q.k1, q.n0, args); });
+}
+
+/*
+ * Piece index of C, cut at quadrant boundaries into 4^depth pieces in
+ * storage order, += its share of A * B, all on the calling worker.  The
+ * base-4 digits of index pick the quadrant of each level, top level first.
+ */
+template <typename T>
+static void mat_mul_piece(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                          const mul_args<T> *args, int index, int depth) {
+    if(depth == 0) {
+        mat_mul_serial(A, B, C, mt, kt, nt, args);
+        return;
+    }
+
+    quadrants<T> q;
+    split_quadrants(&q, A, B, C, mt, kt, nt, args->tile);
+
+    int quad = (index >> (2 * (depth - 1))) & 3;
+    int r = quad >> 1, c = quad & 1;
+    int pm = r ? q.m1 : q.m0;
+    int pn = c ? q.n1 : q.n0;
+    if(!pm || !pn) return;
+
+    mat_mul_piece(q.A[2 * r], q.B[c], q.C[quad], pm, q.k0, pn, args, index, depth - 1);
+    if(q.k1) mat_mul_piece(q.A[2 * r + 1], q.B[2 + c], q.C[quad], pm, q.k1, pn, args, index, depth - 1);
+}
+
+// pieces of C per worker under MM_NUMA_PARTITIONED, for balance across nodes
+#define LOCAL_PIECES_PER_WORKER 4
+
+/*
+ * Top level for MM_NUMA_PARTITIONED buffers.  C is cut at quadrant
+ * boundaries into at least one piece per node and LOCAL_PIECES_PER_WORKER
+ * per worker, and every piece is queued on the node its pages are bound
+ * to; the pieces of a node are a contiguous range of indices.  Each worker
+ * takes the pieces of its own node first, running every one whole on
+ * itself, and then helps with the queues of the other nodes.
+ */
+template <typename T>
+static void mat_mul_local(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                          const mul_args<T> *args) {
+    if(product_empty(A, B, mt, kt, nt, args)) return;
+
+    int workers = mm_parallel_workers();
+    int nodes = mm_numa_nodes();
+    int target = workers * LOCAL_PIECES_PER_WORKER > nodes ? workers * LOCAL_PIECES_PER_WORKER : nodes;
+    int span = mt > nt ? mt : nt;
+    int depth = 0, pieces = 1;
+    while(pieces < target && (1 << depth) < span) {
+        depth++;
+        pieces *= 4;
+    }
+
+    // node n owns pieces [first[n], first[n + 1]) and next[n] is its queue
+    int *first = (int *) malloc((nodes + 1) * sizeof(int));
+    if(!first) {
+        mat_mul_par(A, B, C, mt, kt, nt, args);
+        return;
+    }
+    std::atomic<int> *next = new std::atomic<int>[nodes];
+    for(int node = 0, index = 0; node < nodes; node++) {
+        while(index < pieces && mm_numa_piece_node(index, pieces) < node) index++;
+        first[node] = index;
+        next[node] = index;
+    }
+    first[nodes] = pieces;
+
+    //the pieces run serially, so nothing else runs on a worker while it is pinned
+    mm_parallel_for(0, workers, [&](size_t) {
+        struct bitmask *saved;
+        int home = mm_numa_pin_worker(&saved);
+        if(home < 0) home = 0;
+        for(int step = 0; step < nodes; step++) {
+            int node = (home + step) % nodes;
+            for(int index; (index = next[node]++) < first[node + 1]; )
+                mat_mul_piece(A, B, C, mt, kt, nt, args, index, depth);
+        }
+        mm_numa_unpin_worker(saved);
+    });
+
+    free(first);
+    delete[] next;
+}
+
+// Strassen-Winograd forms sums of operand quadrants, which int8 cannot hold
+template <typename T> struct strassen_ok { enum { value = 1 }; };
+template <> struct strassen_ok<int8_t> { enum { value = 0 }; };
+// nor would float sums of mixed operands keep the refined parts exact
+template <> struct strassen_ok<mm_mixed> { enum { value = 0 }; };
+
+// elements per step of the parallel elementwise loops
+#define ELEMENTWISE_GRAIN 4096
+
+static inline int strassen_level(int depth, int mt, int kt, int nt) {
+    return depth > 0 && mt % 2 == 0 && kt % 2 == 0 && nt % 2 == 0;
+}
+
+/*
+ * Bytes of scratch a Strassen recursion of the given depth needs: the four
+ * S and four T operand sums and seven products of this level, followed by
+ * a separate region for each of the seven sub-multiplies so they can run
+ * in parallel.  Every piece is a whole number of tiles, which keeps all of
+ * them 64-byte aligned relative to the start for leaves of 8 or more.
+ */
+template <typename T>
+static size_t strassen_bytes(int mt, int kt, int nt, int depth, size_t tile_size) {
+    if(!strassen_ok<T>::value || !strassen_level(depth, mt, kt, nt)) return 0;
+
+    size_t qa = (size_t)(mt >> 1) * (kt >> 1) * tile_size;
+    size_t qb = (size_t)(kt >> 1) * (nt >> 1) * tile_size;
+    size_t qc = (size_t)(mt >> 1) * (nt >> 1) * tile_size;
+    return 4 * (qa + qb) * sizeof(T) + 7 * qc * sizeof(typename mm_types<T>::acc) +
+           7 * strassen_bytes<T>(mt >> 1, kt >> 1, nt >> 1, depth - 1, tile_size);
+}
+
+template <typename T>
+static void mat_mul_rec(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                        const mul_args<T> *args, int depth, char *ws);
+
+/*
+ * One level of Strassen-Winograd on equally sized quadrants.  Because the
+ * four quadrants of a Morton buffer have identical layouts, quadrant sums
+ * are plain elementwise sums of the buffers.
+ *
+ *   S1 = A21 + A22   S2 = S1 - A11   S3 = A11 - A21   S4 = A12 - S2
+ *   T1 = B12 - B11   T2 = B22 - T1   T3 = B22 - B12   T4 = T2 - B21
+ *   P1 = A11 B11  P2 = A12 B21  P3 = S4 B22  P4 = A22 T4
+ *   P5 = S1 T1    P6 = S2 T2    P7 = S3 T3
+ *   U2 = P1 + P6  U3 = U2 + P7
+ *   C11 += P1 + P2        C12 += U2 + P5 + P3
+ *   C21 += U3 - P4        C22 += U3 + P5
+ */
+template <typename T>
+static void mat_mul_strassen(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                             const mul_args<T> *args, int depth, char *ws) {
+
+    typedef typename mm_types<T>::acc acc_t;
+
+    const size_t tile_size = args->tile;
+    int mh = mt >> 1, kh = kt >> 1, nh = nt >> 1;
+    size_t qa = (size_t)mh * kh * tile_size;
+    size_t qb = (size_t)kh * nh * tile_size;
+    size_t qc = (size_t)mh * nh * tile_size;
+
+    const T *A11 = A, *A12 = A + qa, *A21 = A + 2 * qa, *A22 = A + 3 * qa;
+    const T *B11 = B, *B21 = B + qb, *B12 = B + 2 * qb, *B22 = B + 3 * qb;
+    acc_t *C11 = C, *C12 = C + qc, *C21 = C + 2 * qc, *C22 = C + 3 * qc;
+
+    T *S = (T *) ws;
+    T *S1 = S, *S2 = S + qa, *S3 = S + 2 * qa, *S4 = S + 3 * qa;
+    T *Tb = S + 4 * qa;
+    T *T1 = Tb, *T2 = Tb + qb, *T3 = Tb + 2 * qb, *T4 = Tb + 3 * qb;
+    acc_t *P = (acc_t *)(Tb + 4 * qb);
+    acc_t *P1 = P, *P2 = P + qc, *P3 = P + 2 * qc, *P4 = P + 3 * qc;
+    acc_t *P5 = P + 4 * qc, *P6 = P + 5 * qc, *P7 = P + 6 * qc;
+    char *child_ws = (char *)(P + 7 * qc);
+    size_t child_bytes = strassen_bytes<T>(mh, kh, nh, depth - 1, tile_size);
+
+    mm_parallel_invoke(
+        [&] { mm_zero(P, 7 * qc); },
+        [&] {
+            mm_parallel_for_range(0, qa, ELEMENTWISE_GRAIN, [&](size_t i, size_t end) {
+                for(size_t e = i; e < end; e++) {
+                    T s1 = A21[e] + A22[e];
+                    S1[e] = s1;
+                    S2[e] = s1 - A11[e];
+                    S3[e] = A11[e] - A21[e];
+                    S4[e] = A12[e] - (s1 - A11[e]);
+                }
+            });
+            mm_parallel_for_range(0, qb, ELEMENTWISE_GRAIN, [&](size_t i, size_t end) {
+                for(size_t e = i; e < end; e++) {
+                    T t1 = B12[e] - B11[e];
+                    T1[e] = t1;
+                    T2[e] = B22[e] - t1;
+                    T3[e] = B22[e] - B12[e];
+                    T4[e] = (B22[e] - t1) - B21[e];
+                }
+            });
+        });
+
+    //the seven products are independent
+    mm_parallel_invoke(
+        [&] { mat_mul_rec(A11, B11, P1, mh, kh, nh, args, depth - 1, child_ws); },
+        [&] { mat_mul_rec(A12, B21, P2, mh, kh, nh, args, depth - 1, child_ws + child_bytes); },
+        [&] { mat_mul_rec((const T *) S4, B22, P3, mh, kh, nh, args, depth - 1, child_ws + 2 * child_bytes); },
+        [&] { mat_mul_rec(A22, (const T *) T4, P4, mh, kh, nh, args, depth - 1, child_ws + 3 * child_bytes); },
+        [&] { mat_mul_rec((const T *) S1, (const T *) T1, P5, mh, kh, nh, args, depth - 1, child_ws + 4 * child_bytes); },
+        [&] { mat_mul_rec((const T *) S2, (const T *) T2, P6, mh, kh, nh, args, depth - 1, child_ws + 5 * child_bytes); },
+        [&] { mat_mul_rec((const T *) S3, (const T *) T3, P7, mh, kh, nh, args, depth - 1, child_ws + 6 * child_bytes); });
+
+    mm_parallel_for_range(0, qc, ELEMENTWISE_GRAIN, [&](size_t i, size_t end) {
+        for(size_t e = i; e < end; e++) {
+            acc_t u2 = P1[e] + P6[e];
+            acc_t u3 = u2 + P7[e];
+            C11[e] += P1[e] + P2[e];
+            C12[e] += u2 + P5[e] + P3[e];
+            C21[e] += u3 - P4[e];
+            C22[e] += u3 + P5[e];
+        }
+    });
+}
+
+/*
+ * The temporary-buffer variant runs all eight sub-products of a level at
+ * once: the four k0 products accumulate into C as usual and the four k1
+ * products into a zeroed buffer laid out like C, which is then added in.
+ * That removes the sync between the two rounds of mat_mul_par at the cost
+ * of an extra C-sized buffer per level and per concurrent branch.
+ */
+static inline int temp_level(int depth, int mt, int kt, int nt, int serial_tiles) {
+    return depth > 0 && kt > 1 &&
+           !(mt <= serial_tiles && kt <= serial_tiles && nt <= serial_tiles);
+}
+
+// bytes of workspace mat_mul_temp needs: its buffer plus a region per sub-product
+template <typename T>
+static size_t temp_bytes(int mt, int kt, int nt, int depth, size_t tile_size, int serial_tiles) {
+    if(!temp_level(depth, mt, kt, nt, serial_tiles)) return 0;
+
+    return (size_t)mt * nt * tile_size * sizeof(typename mm_types<T>::acc) +
+           8 * temp_bytes<T>(split_tiles(mt), split_tiles(kt), split_tiles(nt), depth - 1, tile_size,
+                             serial_tiles);
+}
+
+template <typename T>
+static void mat_mul_temp(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                         const mul_args<T> *args, int depth, char *ws) {
+
+    typedef typename mm_types<T>::acc acc_t;
+
+    if(product_empty(A, B, mt, kt, nt, args)) return;
+    if(!temp_level(depth, mt, kt, nt, args->serial_tiles)) {
+        mat_mul_par(A, B, C, mt, kt, nt, args);
+        return;
+    }
+
+    const size_t count = (size_t)mt * nt * args->tile;
+    acc_t *tmp = (acc_t *) ws;
+    char *child_ws = (char *)(tmp + count);
+    size_t child_bytes = temp_bytes<T>(split_tiles(mt), split_tiles(kt), split_tiles(nt), depth - 1,
+                                       args->tile, args->serial_tiles);
+
+    quadrants<T> q, t;
+    split_quadrants(&q, A, B, C, mt, kt, nt, args->tile);
+    split_quadrants(&t, A, B, tmp, mt, kt, nt, args->tile);
+
+    mm_zero(tmp, count);
+
+    mm_parallel_invoke(
+        [&] { if(q.n1) mat_mul_temp(q.A[0], q.B[1], q.C[1], q.m0, q.k0, q.n1, args, depth - 1, child_ws + child_bytes); },
+        [&] { if(q.m1) mat_mul_temp(q.A[2], q.B[0], q.C[2], q.m1, q.k0, q.n0, args, depth - 1, child_ws + 2 * child_bytes); },
+        [&] { if(q.m1 && q.n1) mat_mul_temp(q.A[2], q.B[1], q.C[3], q.m1, q.k0, q.n1, args, depth - 1, child_ws + 3 * child_bytes); },
+        [&] { if(q.n1) mat_mul_temp(q.A[1], q.B[3], t.C[1], q.m0, q.k1, q.n1, args, depth - 1, child_ws + 4 * child_bytes); },
+        [&] { if(q.m1) mat_mul_temp(q.A[3], q.B[2], t.C[2], q.m1, q.k1, q.n0, args, depth - 1, child_ws + 5 * child_bytes); },
+        [&] { if(q.m1 && q.n1) mat_mul_temp(q.A[3], q.B[3], t.C[3], q.m1, q.k1, q.n1, args, depth - 1, child_ws + 6 * child_bytes); },
+        [&] { mat_mul_temp(q.A[1], q.B[2], t.C[0], q.m0, q.k1, q.n0, args, depth - 1, child_ws + 7 * child_bytes); },
+        [&] { mat_mul_temp(q.A[0], q.B[0], q.C[0], q.m0, q.k0, q.n0, args, depth - 1, child_ws); });
+    //the only sync of this level
+
+    mm_parallel_for_range(0, count, ELEMENTWISE_GRAIN, [&](size_t i, size_t end) {
+        for(size_t e = i; e < end; e++)
+            C[e] += tmp[e];
+    });
+}
+
+/*
+ * Entry to the recursion: Strassen-Winograd for the top depth levels that
+ * split evenly, the classical mat_mul_par below them.
+ */
+template <typename T>
+static void mat_mul_rec(const T *A, const T *B, typename mm_types<T>::acc *C, int mt, int kt, int nt,
+                        const mul_args<T> *args, int depth, char *ws) {
+    if(strassen_ok<T>::value && strassen_level(depth, mt, kt, nt))
+        mat_mul_strassen(A, B, C, mt, kt, nt, args, depth, ws);
+    else
+        mat_mul_par(A, B, C, mt, kt, nt, args);
+}
+
+// layout conversions handled by convert_morton
+enum { PACK_A, PACK_B, UNPACK_C, UNPACK_B };
+
+/*
+ * Everything about a conversion that stays fixed during the recursion.
+ * dense is the rows x cols logical matrix with leading dimension ld; when
+ * trans is set it is stored transposed, i.e. element (i, j) lives at
+ * dense[j * ld + i].  alpha, beta and the epilogue are only used by
+ * UNPACK_C, which also reads back A-style buffers; UNPACK_B reads back
+ * B-style ones.  U is the
+ * element type of both dense and the Morton buffer.  A pack that writes
+ * some other layout sets pack_tile, which then stands in for convert_tile
+ * and gets each tile's element offset into the Morton order instead.
+ */
+template <typename U>
+struct convert_args {
+    U *dense;
+    int rows;
+    int cols;
+    int ld;
+    int kind;
+    int trans;
+    U alpha;
+    U beta;
+    int bs;         // leaf tile width
+    const mm_epilogue<U> *epilogue;     // UNPACK_C only, may be 0
+    U *z;                   // the Morton buffer and, for PACK_A / PACK_B when
+    uint32_t *occupancy;    // occupancy is given, where each tile's nonzero flag goes
+    void (*pack_tile)( const convert_args<U> *args, size_t offset, int row_index, int col_index );
+    void *pack_arg;
+};
+
+// ReLU and clamp need ordered values, so complex accumulators take neither
+template <typename U> struct epilogue_order {
+    enum { value = 1 };
+    static void apply(const mm_epilogue<U> *epilogue, U *x, int count) {
+        if( epilogue->relu )
+            for( int i = 0; i < count; i++ )
+                if( x[i] < U( 0 ) ) x[i] = U( 0 );
+        if( epilogue->clamp )
+            for( int i = 0; i < count; i++ )
+                x[i] = x[i] < epilogue->lo ? epilogue->lo : x[i] > epilogue->hi ? epilogue->hi : x[i];
+    }
+};
+template <typename R> struct epilogue_order< std::complex<R> > {
+    enum { value = 0 };
+    static void apply(const mm_epilogue< std::complex<R> > *, std::complex<R> *, int) {}
+};
+
+// the epilogue on count finished elements of C starting at (row, col)
+template <typename U>
+static inline void apply_epilogue( const mm_epilogue<U> *epilogue, U *x, int count, int row, int col )
+{
+    if( epilogue->bias )
+        for( int i = 0; i < count; i++ )
+            x[i] += epilogue->bias[col + i];
+    if( epilogue->row_bias )
+        for( int i = 0; i < count; i++ )
+            x[i] += epilogue->row_bias[row];
+    epilogue_order<U>::apply( epilogue, x, count );
+    if( epilogue->hook ) epilogue->hook( x, count, row, col, epilogue->arg );
+}
+
+// 1 when the rows x cols block at src (leading dimension ld) has a nonzero, else 0
+template <typename U>
+static inline uint32_t tile_occupied( const U *src, size_t ld, int rows, int cols )
+{
+    for( int p = 0; p < rows; p++ )
+        for( int q = 0; q < cols; q++ )
+            if( src[p * ld + q] != U( 0 ) ) return 1;
+    return 0;
+}
+
+void mm_occupancy_counts(uint32_t *occupancy, size_t tiles)
+{
+    uint32_t sum = 0;
+    for( size_t t = 0; t < tiles; t++ )
+    {
+        uint32_t flag = occupancy[t];
+        occupancy[t] = sum;
+        sum += flag;
+    }
+    occupancy[tiles] = sum;
+}
+
+// dense tiles are told apart at their first element
+template <typename T>
+void mm_occupancy_flags(const T *z, size_t tiles, int bs, uint32_t *flags)
+{
+    size_t tile = (size_t)bs * bs;
+    mm_parallel_for_range( 0, tiles, CONVERT_GRAIN_TILES, [&]( size_t lo, size_t hi ) {
+        for( size_t t = lo; t < hi; t++ )
+            flags[t] = tile_occupied( z + t * tile, tile, 1, (int) tile );
+    } );
+}
+
+// the occupancy of a packed rows x cols buffer, as mm_pack records it, or 0 when out of memory
+template <typename T>
+static uint32_t *scan_occupancy( const T *z, int rows, int cols, int bs )
+{
+    size_t tiles = (size_t)num_tiles( rows, bs ) * num_tiles( cols, bs );
+    uint32_t *occupancy = (uint32_t *) malloc( ( tiles + 1 ) * sizeof(uint32_t) );
+    if( !occupancy ) return 0;
+
+    mm_occupancy_flags( z, tiles, bs, occupancy );
+    mm_occupancy_counts( occupancy, tiles );
+    return occupancy;
+}
+
+/*
+ * Convert the one leaf tile whose top-left element is (row_index, col_index).
+ * Rows are always walked in the dense matrix's storage order, so a tile
+ * that needs transposing is a blocked transpose that reads contiguous
+ * source rows and scatters into the L1-resident tile rather than gathering
+ * down columns of dense.
+ */
+template <typename U>
+static void convert_tile( const convert_args<U> *args, U *tile, int row_index, int col_index )
+{
+    const int bs = args->bs;
+    int row_end = args->rows - row_index < bs ? args->rows - row_index : bs;
+    int col_end = args->cols - col_index < bs ? args->cols - col_index : bs;
+    int full = ( row_end == bs && col_end == bs );
+
+    if( args->kind == UNPACK_C )
+    {
+        U *base = args->dense + (size_t)row_index * args->ld + col_index;
+        U alpha = args->alpha, beta = args->beta;
+
+        for( int row_idx = 0; row_idx < row_end; row_idx++ )
+        {
+            U *dst = base + (size_t)row_idx * args->ld;
+            const U *src = tile + row_idx * bs;
+
+            if( alpha == U( 1 ) && beta == U( 0 ) )
+                memcpy( (void *) dst, src, col_end * sizeof(U) );
+            else if( beta == U( 0 ) )
+                for( int col_idx = 0; col_idx < col_end; col_idx++ )
+                    dst[col_idx] = alpha * src[col_idx];
+            else
+                for( int col_idx = 0; col_idx < col_end; col_idx++ )
+                    dst[col_idx] = alpha * src[col_idx] + beta * dst[col_idx];
+
+            // the row segment is still in cache, so the epilogue costs no extra sweep
+            if( args->epilogue ) apply_epilogue( args->epilogue, dst, col_end, row_index + row_idx, col_index );
+        }
+        return;
+    }
+
+    if( args->kind == UNPACK_B )
+    {
+        // B tiles are column major
+        U *base = args->dense + (size_t)row_index * args->ld + col_index;
+        for( int row_idx = 0; row_idx < row_end; row_idx++ )
+        {
+            U *dst = base + (size_t)row_idx * args->ld;
+            for( int col_idx = 0; col_idx < col_end; col_idx++ )
+                dst[col_idx] = tile[col_idx * bs + row_idx];
+        }
+        return;
+    }
+
+    if( !full )
+    {
+        // edge tile; the part outside the matrix is zero padding
+        memset( (void *) tile, 0, (size_t)bs * bs * sizeof(U) );
+    }
+
+    // walk the tile in dense storage coordinates (p, q); a transposed source
+    // swaps which logical dimension p runs along
+    const U *base;
+    int p_end, q_end;
+    if( args->trans )
+    {
+        base = args->dense + (size_t)col_index * args->ld + row_index;
+        p_end = col_end;
+        q_end = row_end;
+    }
+    else
+    {
+        base = args->dense + (size_t)row_index * args->ld + col_index;
+        p_end = row_end;
+        q_end = col_end;
+    }
+
+    // the tile is still in L1, so flagging it costs no extra pass over the buffer
+    if( args->occupancy )
+        args->occupancy[(size_t)( tile - args->z ) / ( (size_t)bs * bs )] = tile_occupied( base, args->ld, p_end, q_end );
+
+    // A tiles are row major and B tiles column major, so the tile is a plain
+    // copy of the dense block exactly when the B-ness matches trans
+    if( ( args->kind == PACK_B ) == ( args->trans != 0 ) )
+    {
+        for( int p = 0; p < p_end; p++ )
+            memcpy( (void *)( tile + p * bs ), base + (size_t)p * args->ld, q_end * sizeof(U) );
+    }
+    else if( full )
+    {
+        for( int p = 0; p < bs; p++ )
+        {
+            const U *src_row = base + (size_t)p * args->ld;
+            for( int q = 0; q < bs; q++ )
+                tile[q * bs + p] = src_row[q];
+        }
+    }
+    else
+    {
+        for( int p = 0; p < p_end; p++ )
+        {
+            const U *src_row = base + (size_t)p * args->ld;
+            for( int q = 0; q < q_end; q++ )
+                tile[q * bs + p] = src_row[q];
+        }
+    }
+}
+
+/*
+ * Walk the tile_rows x tile_cols tile region at (row_index, col_index) in
+ * Morton-Z order, converting between args->dense and the Morton buffer
+ * from element offset z on.
+ * A-style buffers (PACK_A, UNPACK_C) order quadrants top-left, top-right,
+ * bottom-left, bottom-right; B-style buffers (PACK_B, UNPACK_B) order them top-left,
+ * bottom-left, top-right, bottom-right.  Quadrants are converted in parallel
+ * until a region is at most CONVERT_GRAIN_TILES tiles.
+ */
+template <typename U>
+static void convert_morton( const convert_args<U> *args, size_t z, int tile_rows, int tile_cols, int row_index, int col_index )
+{
+    if( tile_rows == 1 && tile_cols == 1 )
+    {
+        // reached base case
+        if( args->pack_tile )
+            args->pack_tile( args, z, row_index, col_index );
+        else
+            convert_tile( args, args->z + z, row_index, col_index );
+        return;
+    }
+
+    // compute new location within the morton z buffer
+    const int bs = args->bs;
+    const size_t tile_size = (size_t)bs * bs;
+    int tr0 = split_tiles( tile_rows ), tr1 = tile_rows - tr0;
+    int tc0 = split_tiles( tile_cols ), tc1 = tile_cols - tc0;
+    size_t top_left = z;
+    size_t top_right, bottom_left, bottom_right;
+    if( args->kind == PACK_B || args->kind == UNPACK_B )
+    {
+        bottom_left  = z + (size_t)tr0 * tc0 * tile_size;
+        top_right    = z + (size_t)tile_rows * tc0 * tile_size;
+        bottom_right = top_right + (size_t)tr0 * tc1 * tile_size;
+    }
+    else
+    {
+        top_right    = z + (size_t)tr0 * tc0 * tile_size;
+        bottom_left  = z + (size_t)tr0 * tile_cols * tile_size;
+        bottom_right = bottom_left + (size_t)tr1 * tc0 * tile_size;
+    }
+    int row_half = row_index + tr0 * bs;
+    int col_half = col_index + tc0 * bs;
+
+    // recursively sub-partition the matrix until the base case is reached
+    if( (size_t)tile_rows * tile_cols <= CONVERT_GRAIN_TILES )
+    {
+        convert_morton( args, top_left, tr0, tc0, row_index, col_index );
+        if( tc1 ) convert_morton( args, top_right, tr0, tc1, row_index, col_half );
+        if( tr1 ) convert_morton( args, bottom_left, tr1, tc0, row_half, col_index );
+        if( tr1 && tc1 ) convert_morton( args, bottom_right, tr1, tc1, row_half, col_half );
+        return;
+    }
+
+    mm_parallel_invoke(
+        [&] { if( tc1 ) convert_morton( args, top_right, tr0, tc1, row_index, col_half ); },
+        [&] { if( tr1 ) convert_morton( args, bottom_left, tr1, tc0, row_half, col_index ); },
+        [&] { if( tr1 && tc1 ) convert_morton( args, bottom_right, tr1, tc1, row_half, col_half ); },
+        [&] { convert_morton( args, top_left, tr0, tc0, row_index, col_index ); } );
+}
+
+static int is_trans( char trans )
+{
+    return trans == 'T' || trans == 't' || trans == 'C' || trans == 'c';
+}
+
+/*
+ * Pack src into z_dest.  When occupancy is given, it receives the occupancy
+ * of z_dest (num_tiles( rows ) * num_tiles( cols ) + 1 entries).
+ */
+template <typename T>
+static void pack( int kind, char trans, int rows, int cols, const T *src, int ld, T *z_dest, int bs,
+                  uint32_t *occupancy )
+{
+    if( rows <= 0 || cols <= 0 ) return;
+
+    convert_args<T> args = { (T *) src, rows, cols, ld, kind, is_trans( trans ), T( 1 ), T( 0 ), bs, 0,
+                             z_dest, occupancy, 0, 0 };
+    convert_morton( &args, 0, num_tiles( rows, bs ), num_tiles( cols, bs ), 0, 0 );
+    if( occupancy ) mm_occupancy_counts( occupancy, (size_t)num_tiles( rows, bs ) * num_tiles( cols, bs ) );
+}
+
+// an occupancy array for a packed rows x cols operand, to be filled by pack
+static uint32_t *alloc_occupancy( int rows, int cols, int bs )
+{
+    return (uint32_t *) malloc( ( (size_t)num_tiles( rows, bs ) * num_tiles( cols, bs ) + 1 ) * sizeof(uint32_t) );
+}
+
+/*
+ * c_morton += a_morton * b_morton.  a_occupancy and b_occupancy are the
+ * occupancy of the operands from pack, or 0 to scan them here; products of
+ * all-zero quadrants are skipped, except under Strassen, whose operand sums
+ * live in other buffers.
+ */
+template <typename T>
+static void multiply_morton(int m, int n, int k, const T *a_morton, const T *b_morton,
+                            typename mm_types<T>::acc *c_morton, int bs,
+                            const uint32_t *a_occupancy, const uint32_t *b_occupancy)
+{
+    if( m <= 0 || n <= 0 || k <= 0 ) return;
+
+    mul_args<T> args;
+    args.kernel = mm_kernel_select<T>( bs, forced_kernel[0] ? forced_kernel : 0, 0 );
+    args.bs = bs;
+    args.tile = (size_t)bs * bs;
+    args.serial_tiles = current_spawn_grain() / bs;
+    if( args.serial_tiles < 1 ) args.serial_tiles = 1;     // single tiles go straight to the kernel
+    args.a_base = a_morton;
+    args.b_base = b_morton;
+    args.a_occupancy = 0;
+    args.b_occupancy = 0;
+
+    int mt = num_tiles( m, bs ), kt = num_tiles( k, bs ), nt = num_tiles( n, bs );
+    int depth = engine_options.strassen_depth;
+    size_t ws_bytes = strassen_bytes<T>( mt, kt, nt, depth, args.tile );
+    char *ws = 0;
+    if( ws_bytes )
+    {
+        ws = (char *) mm_workspace_acquire( ws_bytes, 0 );
+        if( !ws ) depth = 0;    // not enough memory for the temporaries
+    }
+
+    uint32_t *a_scanned = 0, *b_scanned = 0;
+    if( !ws )
+    {
+        if( !a_occupancy ) a_occupancy = a_scanned = scan_occupancy( a_morton, m, k, bs );
+        if( !b_occupancy ) b_occupancy = b_scanned = scan_occupancy( b_morton, k, n, bs );
+        args.a_occupancy = a_occupancy;
+        args.b_occupancy = b_occupancy;
+    }
+
+    if( !ws_bytes && engine_options.temp_depth > 0 )
+    {
+        // as many temporary-buffer levels as requested and as fit in memory
+        size_t budget = temp_budget();
+        int temp_depth = engine_options.temp_depth;
+        while( temp_depth > 0 &&
+               temp_bytes<T>( mt, kt, nt, temp_depth, args.tile, args.serial_tiles ) > budget )
+            temp_depth--;
+
+        ws_bytes = temp_bytes<T>( mt, kt, nt, temp_depth, args.tile, args.serial_tiles );
+        if( ws_bytes && ( ws = (char *) mm_workspace_acquire( ws_bytes, 0 ) ) )
+        {
+            mat_mul_temp( a_morton, b_morton, c_morton, mt, kt, nt, &args, temp_depth, ws );
+            mm_workspace_release( ws );
+            free( a_scanned );
+            free( b_scanned );
+            return;
+        }
+    }
+
+    if( !ws && engine_options.numa_policy == MM_NUMA_PARTITIONED )
+        mat_mul_local( a_morton, b_morton, c_morton, mt, kt, nt, &args );
+    else
+        mat_mul_rec( a_morton, b_morton, c_morton, mt, kt, nt, &args, depth, ws );
+    mm_workspace_release( ws );
+    free( a_scanned );
+    free( b_scanned );
+}
+
+template <typename U>
+static void unpack_morton(int m, int n, U alpha, const U *c_morton, U beta, U *C, int ldc, int bs,
+                          const mm_epilogue<U> *epilogue)
+{
+    if( m <= 0 || n <= 0 ) return;
+
+    convert_args<U> args = { C, m, n, ldc, UNPACK_C, 0, alpha, beta, bs, epilogue, (U *) c_morton, 0, 0, 0 };
+    convert_morton( &args, 0, num_tiles( m, bs ), num_tiles( n, bs ), 0, 0 );
+}
+
+size_t mm_morton_size(int rows, int cols)
+{
+    return morton_size( rows, cols, current_leaf_size() );
+}
+
+template <typename T>
+void mm_pack_a(char trans, int m, int k, const T *A, int lda, T *a_morton)
+{
+    pack( PACK_A, trans, m, k, A, lda, a_morton, current_leaf_size(), 0 );
+}
+
+template <typename T>
+void mm_pack_b(char trans, int k, int n, const T *B, int ldb, T *b_morton)
+{
+    pack( PACK_B, trans, k, n, B, ldb, b_morton, current_leaf_size(), 0 );
+}
+
+template <typename U>
+void mm_zero(U *morton, size_t count)
+{
+    mm_parallel_for_range( 0, count, ELEMENTWISE_GRAIN, [&]( size_t lo, size_t hi ) {
+        memset( (void *)( morton + lo ), 0, ( hi - lo ) * sizeof(U) );
+    } );
+}
+
+template <typename T>
+void mm_multiply(int m, int n, int k, const T *a_morton,
+                 const T *b_morton, typename mm_types<T>::acc *c_morton)
+{
+    multiply_morton( m, n, k, a_morton, b_morton, c_morton, current_leaf_size(), 0, 0 );
+}
+
+template <typename T>
+void mm_multiply_occupied(int m, int n, int k, const T *a_morton, const uint32_t *a_occupancy,
+                          const T *b_morton, const uint32_t *b_occupancy, typename mm_types<T>::acc *c_morton)
+{
+    multiply_morton( m, n, k, a_morton, b_morton, c_morton, current_leaf_size(), a_occupancy, b_occupancy );
+}
+
+template <typename U>
+void mm_unpack(int m, int n, typename mm_identity<U>::type alpha, const U *c_morton,
+               typename mm_identity<U>::type beta, U *C, int ldc)
+{
+    unpack_morton<U>( m, n, alpha, c_morton, beta, C, ldc, current_leaf_size(), 0 );
+}
+
+template <typename U>
+int mm_unpack_epilogue(int m, int n, typename mm_identity<U>::type alpha, const U *c_morton,
+                       typename mm_identity<U>::type beta, U *C, int ldc, const mm_epilogue<U> *epilogue)
+{
+    if( epilogue && !epilogue_order<U>::value && ( epilogue->relu || epilogue->clamp ) ) return -1;
+    unpack_morton<U>( m, n, alpha, c_morton, beta, C, ldc, current_leaf_size(), epilogue );
+    return 0;
+}
+
+// rows of the streamed operand per block, k values per chunk of the skinny path
+#define SKINNY_ROWS 16
+#define SKINNY_CHUNK 256
+// elements of the streamed operand per parallel step, at least
+#define SKINNY_GRAIN 32768
+
+/*
+ * The skinny path of gemm_morton: C = alpha * S * W + beta * C for a rows x k
+ * operand S that is streamed once and a k x cols operand W with cols at most
+ * MM_SKINNY_MAX.  Element (i, p) of S is S[i * lds + p], or S[p * lds + i]
+ * when s_trans.  Element (p, j) of W is W[j * ldw + p] when w_cols, else
+ * W[p * ldw + j] and W is first copied that way, into scratch or a workspace
+ * buffer when scratch is 0, so the row kernels always see contiguous columns.  The result (i, j) is C(i, j), or C(j, i) when
+ * swapped, which is how a small m is handled: C^T = op(B)^T op(A)^T.
+ *
+ * Each parallel step takes blocks of SKINNY_ROWS rows of S; a block keeps
+ * its rows of the result in registers and on the stack and walks k in
+ * chunks of SKINNY_CHUNK, so that chunk of W stays in cache for all its
+ * rows.  A transposed S is gathered one block and chunk at a time.
+ */
+template <typename T>
+static int gemm_skinny(int rows, int cols, int k, typename mm_types<T>::acc alpha,
+                       const T *S, int lds, int s_trans, const T *W, int ldw, int w_cols,
+                       typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc, int swapped,
+                       const mm_epilogue<typename mm_types<T>::acc> *epilogue, T *scratch)
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    typename mm_row_kernel<T>::fn kernel = mm_row_kernel_select<T>( forced_kernel[0] ? forced_kernel : 0, 0 );
+
+    T *w_tmp = 0;
+    if( !w_cols )
+    {
+        T *w_copy = scratch;
+        if( !w_copy && !( w_copy = w_tmp = (T *) mm_workspace_acquire( (size_t) cols * k * sizeof(T), 0 ) ) )
+            return -1;
+        mm_parallel_for_range( 0, k, SKINNY_CHUNK, [&]( size_t lo, size_t hi ) {
+            for( size_t p = lo; p < hi; p++ )
+                for( int j = 0; j < cols; j++ )
+                    w_copy[(size_t) j * k + p] = W[p * ldw + j];
+        } );
+        W = w_copy;
+        ldw = k;
+    }
+
+    int blocks = ( rows + SKINNY_ROWS - 1 ) / SKINNY_ROWS;
+    size_t grain = SKINNY_GRAIN / ( (size_t) SKINNY_ROWS * k );
+    std::atomic<int> failed( 0 );
+    mm_parallel_for_range( 0, blocks, grain > 0 ? grain : 1, [&]( size_t lo, size_t hi ) {
+        T *panel = 0;
+        if( s_trans && !( panel = (T *) malloc( SKINNY_ROWS * SKINNY_CHUNK * sizeof(T) ) ) )
+        {
+            failed.store( 1, std::memory_order_relaxed );
+            return;
+        }
+
+        for( size_t b = lo; b < hi; b++ )
+        {
+            int i0 = (int) b * SKINNY_ROWS;
+            int nr = rows - i0 < SKINNY_ROWS ? rows - i0 : SKINNY_ROWS;
+            acc_t acc[SKINNY_ROWS][MM_SKINNY_MAX];
+            for( int r = 0; r < nr; r++ )
+                for( int j = 0; j < cols; j++ )
+                    acc[r][j] = acc_t();
+
+            for( int p0 = 0; p0 < k; p0 += SKINNY_CHUNK )
+            {
+                int len = k - p0 < SKINNY_CHUNK ? k - p0 : SKINNY_CHUNK;
+                if( s_trans )
+                {
+                    for( int p = 0; p < len; p++ )
+                    {
+                        const T *src = S + (size_t)( p0 + p ) * lds + i0;
+                        for( int r = 0; r < nr; r++ )
+                            panel[r * SKINNY_CHUNK + p] = src[r];
+                    }
+                }
+                for( int r = 0; r < nr; r++ )
+                {
+                    const T *a = s_trans ? panel + r * SKINNY_CHUNK : S + (size_t)( i0 + r ) * lds + p0;
+                    kernel( acc[r], a, W + p0, ldw, len, cols );
+                }
+            }
+
+            for( int r = 0; r < nr; r++ )
+            {
+                int i = i0 + r;
+                if( !swapped )
+                {
+                    acc_t *dst = C + (size_t) i * ldc;
+                    for( int j = 0; j < cols; j++ )
+                        dst[j] = beta == acc_t( 0 ) ? alpha * acc[r][j] : alpha * acc[r][j] + beta * dst[j];
+                    if( epilogue ) apply_epilogue( epilogue, dst, cols, i, 0 );
+                    continue;
+                }
+                for( int j = 0; j < cols; j++ )
+                {
+                    acc_t *dst = C + (size_t) j * ldc + i;
+                    *dst = beta == acc_t( 0 ) ? alpha * acc[r][j] : alpha * acc[r][j] + beta * *dst;
+                    if( epilogue ) apply_epilogue( epilogue, dst, 1, j, i );
+                }
+            }
+        }
+        free( panel );
+    } );
+
+    mm_workspace_release( w_tmp );
+    return failed.load() ? -1 : 0;
+}
+
+static inline int skinny_shape(int m, int n) {
+    return m <= MM_SKINNY_MAX || n <= MM_SKINNY_MAX;
+}
+
+// elements of the copy gemm_skinny_ab makes of the small operand, 0 when it is used in place
+static inline size_t skinny_scratch(int m, int n, int k, char transa, char transb) {
+    if( n <= m ) return is_trans( transb ) ? 0 : (size_t) n * k;
+    return is_trans( transa ) ? (size_t) m * k : 0;
+}
+
+/*
+ * gemm_skinny for C = alpha * op(A) * op(B) + beta * C when skinny_shape(m,
+ * n): the smaller of m and n becomes the columns, a small m through C^T.
+ * scratch holds skinny_scratch elements, or is 0 for a workspace buffer.
+ */
+template <typename T>
+static int gemm_skinny_ab(int m, int n, int k, typename mm_types<T>::acc alpha,
+                          char transa, const T *A, int lda, char transb, const T *B, int ldb,
+                          typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc,
+                          const mm_epilogue<typename mm_types<T>::acc> *epilogue, T *scratch)
+{
+    if( n <= m )
+        return gemm_skinny<T>( m, n, k, alpha, A, lda, is_trans( transa ), B, ldb, is_trans( transb ),
+                               beta, C, ldc, 0, epilogue, scratch );
+    return gemm_skinny<T>( n, m, k, alpha, B, ldb, !is_trans( transb ), A, lda, !is_trans( transa ),
+                           beta, C, ldc, 1, epilogue, scratch );
+}
+
+/*
+ * The common body of the gemm entry points.  Each operand comes either
+ * already packed (a_morton / b_morton non-zero, with its occupancy or 0)
+ * or as a row-major matrix that is packed here into a temporary buffer.
+ */
+template <typename T>
+static int gemm_morton(int m, int n, int k, typename mm_types<T>::acc alpha,
+                       char transa, const T *A, int lda, const T *a_morton, const uint32_t *a_occupancy,
+                       char transb, const T *B, int ldb, const T *b_morton, const uint32_t *b_occupancy,
+                       typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc, int bs,
+                       const mm_epilogue<typename mm_types<T>::acc> *epilogue)
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    if( m < 0 || n < 0 || k < 0 || ldc < (n > 1 ? n : 1) ) return -1;
+    if( epilogue && !epilogue_order<acc_t>::value && ( epilogue->relu || epilogue->clamp ) ) return -1;
+    if( !a_morton && lda < ( is_trans( transa ) ? m : k ) ) return -1;
+    if( !b_morton && ldb < ( is_trans( transb ) ? k : n ) ) return -1;
+    if( m == 0 || n == 0 ) return 0;
+
+    int multiply = ( k > 0 && alpha != acc_t( 0 ) );
+    //skinny shapes stream the larger operand instead of packing, see mm_gemm
+    if( multiply && !a_morton && !b_morton && skinny_shape( m, n ) )
+        return gemm_skinny_ab<T>( m, n, k, alpha, transa, A, lda, transb, B, ldb, beta, C, ldc, epilogue, 0 );
+
+    T *a_tmp = 0, *b_tmp = 0;
+    uint32_t *a_occupancy_tmp = 0, *b_occupancy_tmp = 0;
+    acc_t *c_morton = (acc_t *) mm_numa_alloc( 'C', m, n, sizeof(acc_t), bs );
+    if( multiply && !a_morton )
+    {
+        a_morton = a_tmp = (T *) mm_numa_alloc( 'A', m, k, sizeof(T), bs );
+        a_occupancy = a_occupancy_tmp = alloc_occupancy( m, k, bs );
+    }
+    if( multiply && !b_morton )
+    {
+        b_morton = b_tmp = (T *) mm_numa_alloc( 'B', k, n, sizeof(T), bs );
+        b_occupancy = b_occupancy_tmp = alloc_occupancy( k, n, bs );
+    }
+    if( !c_morton || ( multiply && ( !a_morton || !b_morton ) ) )
+    {
+        mm_workspace_release( a_tmp );
+        mm_workspace_release( b_tmp );
+        mm_workspace_release( c_morton );
+        free( a_occupancy_tmp );
+        free( b_occupancy_tmp );
+        return -1;
+    }
+
+    if( multiply )
+    {
+        mm_parallel_invoke(
+            [&] { if( a_tmp ) pack( PACK_A, transa, m, k, A, lda, a_tmp, bs, a_occupancy_tmp ); },
+            [&] { if( b_tmp ) pack( PACK_B, transb, k, n, B, ldb, b_tmp, bs, b_occupancy_tmp ); },
+            [&] { mm_zero( c_morton, morton_size( m, n, bs ) ); } );
+        multiply_morton( m, n, k, a_morton, b_morton, c_morton, bs, a_occupancy, b_occupancy );
+    }
+    else
+    {
+        mm_zero( c_morton, morton_size( m, n, bs ) );
+    }
+    unpack_morton<acc_t>( m, n, alpha, c_morton, beta, C, ldc, bs, epilogue );
+
+    mm_workspace_release( a_tmp );
+    mm_workspace_release( b_tmp );
+    mm_workspace_release( c_morton );
+    free( a_occupancy_tmp );
+    free( b_occupancy_tmp );
+    return 0;
+}
+
+template <typename T>
+int mm_gemm(char transa, char transb, int m, int n, int k,
+            typename mm_types<T>::acc alpha, const T *A, int lda,
+            const T *B, int ldb,
+            typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc)
+{
+    int bs = engine_options.leaf_size > 0 ? engine_options.leaf_size :
+             mm_tuned_leaf_size( mm_types<T>::dtype, m, n, k );
+    return gemm_morton<T>( m, n, k, alpha, transa, A, lda, 0, 0, transb, B, ldb, 0, 0, beta, C, ldc, bs, 0 );
+}
+
+template <typename T>
+int mm_gemm_epilogue(char transa, char transb, int m, int n, int k,
+                     typename mm_types<T>::acc alpha, const T *A, int lda,
+                     const T *B, int ldb,
+                     typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc,
+                     const mm_epilogue<typename mm_types<T>::acc> *epilogue)
+{
+    int bs = engine_options.leaf_size > 0 ? engine_options.leaf_size :
+             mm_tuned_leaf_size( mm_types<T>::dtype, m, n, k );
+    return gemm_morton<T>( m, n, k, alpha, transa, A, lda, 0, 0, transb, B, ldb, 0, 0, beta, C, ldc, bs, epilogue );
+}
+
+int mm_dgemm(char transa, char transb, int m, int n, int k,
+             double alpha, const double *A, int lda,
+             const double *B, int ldb,
+             double beta, double *C, int ldc)
+{
+    return mm_gemm<double>( transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
+/*
+ * The float operands mm_dgemm_mixed packs a double operand into.  Each run
+ * of bs consecutive elements is one row of an A tile or one column of a B
+ * tile, i.e. the k run of a leaf dot product.  Without lo, main is x
+ * rounded to float.  With it, main is x rounded to a multiple of a
+ * power-of-two unit chosen per run, which leaves it at most beta bits
+ * above that unit; the product of two such parts is a whole number of one
+ * unit per dot product and a kernel lane of at most bs / MM_MIXED_LANES of
+ * them sums to at most 2^24 units, which float holds exactly.  lo is the
+ * float remainder x - main and full, when given, x rounded to float.
+ */
+struct mixed_split {
+    mm_mixed *main;
+    mm_mixed *lo;       // 0 unless refining
+    mm_mixed *full;     // may be 0
+    int beta;
+};
+
+static void split_run( const mixed_split *split, const double *x, int bs, size_t base )
+{
+    if( !split->lo )
+    {
+        for( int e = 0; e < bs; e++ )
+            split->main[base + e] = mm_mixed( x[e] );
+        return;
+    }
+
+    double largest = 0.0;
+    for( int e = 0; e < bs; e++ )
+        if( fabs( x[e] ) > largest ) largest = fabs( x[e] );
+    int exponent;
+    frexp( largest, &exponent );
+    const double unit = ldexp( 1.0, exponent - split->beta );
+    for( int e = 0; e < bs; e++ )
+    {
+        double hi = rint( x[e] / unit ) * unit;
+        split->main[base + e] = mm_mixed( hi );
+        split->lo[base + e] = mm_mixed( x[e] - hi );
+        if( split->full ) split->full[base + e] = mm_mixed( x[e] );
+    }
+}
+
+/*
+ * pack_tile of mm_dgemm_mixed: gathers each run of the tile at offset from
+ * the dense double operand, zero padded past its edge, and splits it
+ * straight into the float tiles, so no double copy of the operand is made.
+ */
+static void split_tile( const convert_args<double> *args, size_t offset, int row_index, int col_index )
+{
+    const mixed_split *split = (const mixed_split *) args->pack_arg;
+    const int bs = args->bs;
+    int row_end = args->rows - row_index < bs ? args->rows - row_index : bs;
+    int col_end = args->cols - col_index < bs ? args->cols - col_index : bs;
+    // A runs are tile rows, B runs tile columns
+    int b_side = ( args->kind == PACK_B );
+    int runs = b_side ? col_end : row_end;
+    int run_end = b_side ? row_end : col_end;
+    // a run is contiguous in dense exactly when the B-ness matches trans
+    size_t stride = ( b_side == ( args->trans != 0 ) ) ? 1 : args->ld;
+    double x[MAX_LEAF_SIZE];
+
+    for( int e = 0; e < bs; e++ ) x[e] = 0.0;
+    for( int r = 0; r < bs; r++ )
+    {
+        if( r == runs )
+            for( int e = 0; e < run_end; e++ ) x[e] = 0.0;
+        if( r < runs )
+        {
+            size_t i = row_index + ( b_side ? 0 : r ), j = col_index + ( b_side ? r : 0 );
+            const double *src = args->dense + ( args->trans ? j * args->ld + i : i * args->ld + j );
+            for( int e = 0; e < run_end; e++ )
+                x[e] = src[e * stride];
+        }
+        split_run( split, x, bs, offset + (size_t)r * bs );
+    }
+}
+
+// packs the rows x cols double operand src into the float operands of split
+static void pack_mixed( int kind, char trans, int rows, int cols, const double *src, int ld, int bs,
+                        const mixed_split *split )
+{
+    convert_args<double> args = { (double *) src, rows, cols, ld, kind, is_trans( trans ), 1.0, 0.0, bs, 0,
+                                  0, 0, split_tile, (void *) split };
+    convert_morton( &args, 0, num_tiles( rows, bs ), num_tiles( cols, bs ), 0, 0 );
+}
+
+int mm_dgemm_mixed(char transa, char transb, int m, int n, int k,
+                   double alpha, const double *A, int lda,
+                   const double *B, int ldb,
+                   double beta, double *C, int ldc, int mode)
+{
+    if( mode != MM_MIXED_FLOAT && mode != MM_MIXED_REFINE ) return -1;
+    //nothing to multiply, mm_dgemm just scales C
+    if( k <= 0 || alpha == 0.0 ) return mm_dgemm( transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+    if( m < 0 || n < 0 || ldc < (n > 1 ? n : 1) ) return -1;
+    if( lda < ( is_trans( transa ) ? m : k ) || ldb < ( is_trans( transb ) ? k : n ) ) return -1;
+    if( m == 0 || n == 0 ) return 0;
+
+    int bs = engine_options.leaf_size > 0 ? engine_options.leaf_size :
+             mm_tuned_leaf_size( MM_FLOAT32, m, n, k );
+    int refine = ( mode == MM_MIXED_REFINE );
+
+    int lane_terms = ( bs + MM_MIXED_LANES - 1 ) / MM_MIXED_LANES;
+    int lane_bits = 0;
+    while( ( 1 << lane_bits ) < lane_terms ) lane_bits++;
+
+    mm_mixed *a_main = (mm_mixed *) mm_numa_alloc( 'A', m, k, sizeof(mm_mixed), bs );
+    mm_mixed *b_main = (mm_mixed *) mm_numa_alloc( 'B', k, n, sizeof(mm_mixed), bs );
+    mm_mixed *a_lo = refine ? (mm_mixed *) mm_numa_alloc( 'A', m, k, sizeof(mm_mixed), bs ) : 0;
+    mm_mixed *b_lo = refine ? (mm_mixed *) mm_numa_alloc( 'B', k, n, sizeof(mm_mixed), bs ) : 0;
+    mm_mixed *b_full = refine ? (mm_mixed *) mm_numa_alloc( 'B', k, n, sizeof(mm_mixed), bs ) : 0;
+    double *c_morton = (double *) mm_numa_alloc( 'C', m, n, sizeof(double), bs );
+    int failed = !a_main || !b_main || !c_morton ||
+                 ( refine && ( !a_lo || !b_lo || !b_full ) );
+
+    if( !failed )
+    {
+        mixed_split a_split = { a_main, a_lo, 0, ( 24 - lane_bits ) / 2 };
+        mixed_split b_split = { b_main, b_lo, b_full, ( 24 - lane_bits ) / 2 };
+        mm_parallel_invoke(
+            [&] { pack_mixed( PACK_A, transa, m, k, A, lda, bs, &a_split ); },
+            [&] { pack_mixed( PACK_B, transb, k, n, B, ldb, bs, &b_split ); },
+            [&] { mm_zero( c_morton, morton_size( m, n, bs ) ); } );
+
+        //refined, hi * hi comes out exact and hi * lo + lo * B adds the rest
+        multiply_morton( m, n, k, a_main, b_main, c_morton, bs, 0, 0 );
+        if( refine )
+        {
+            multiply_morton( m, n, k, a_main, b_lo, c_morton, bs, 0, 0 );
+            multiply_morton( m, n, k, a_lo, b_full, c_morton, bs, 0, 0 );
+        }
+        unpack_morton<double>( m, n, alpha, c_morton, beta, C, ldc, bs, 0 );
+    }
+
+    mm_workspace_release( a_main );
+    mm_workspace_release( b_main );
+    mm_workspace_release( a_lo );
+    mm_workspace_release( b_lo );
+    mm_workspace_release( b_full );
+    mm_workspace_release( c_morton );
+    return failed ? -1 : 0;
+}
+
+template <typename T>
+mm_packed *mm_pack(char side, char trans, int rows, int cols, const T *M, int ld)
+{
+    int is_a = ( side == 'A' || side == 'a' );
+    if( !is_a && side != 'B' && side != 'b' ) return 0;
+    if( rows <= 0 || cols <= 0 || ld < ( is_trans( trans ) ? rows : cols ) ) return 0;
+
+    mm_packed *packed = (mm_packed *) malloc( sizeof(mm_packed) );
+    if( !packed ) return 0;
+    packed->side = is_a ? 'A' : 'B';
+    packed->dtype = mm_types<T>::dtype;
+    packed->rows = rows;
+    packed->cols = cols;
+    packed->leaf_size = current_leaf_size();
+    packed->map = 0;
+    packed->mapped = 0;
+    packed->data = mm_numa_alloc( packed->side, rows, cols, sizeof(T), packed->leaf_size );
+    packed->occupancy = alloc_occupancy( rows, cols, packed->leaf_size );
+    if( !packed->data || !packed->occupancy )
+    {
+        mm_workspace_release( packed->data );
+        free( packed->occupancy );
+        free( packed );
+        return 0;
+    }
+
+    pack( is_a ? PACK_A : PACK_B, trans, rows, cols, M, ld, (T *) packed->data, packed->leaf_size,
+          packed->occupancy );
+    return packed;
+}
+
+void mm_packed_free(mm_packed *packed)
+{
+    if( !packed ) return;
+    if( packed->map )
+        munmap( packed->map, packed->mapped );
+    else
+        mm_workspace_release( packed->data );
+    free( packed->occupancy );
+    free( packed );
+}
+
+template <typename T>
+int mm_packed_unpack(const mm_packed *packed, T *M, int ld)
+{
+    if( !packed || packed->dtype != mm_types<T>::dtype || ld < packed->cols ) return -1;
+
+    // A tiles are laid out like C tiles, B tiles need their own walk
+    convert_args<T> args = { M, packed->rows, packed->cols, ld, packed->side == 'B' ? UNPACK_B : UNPACK_C,
+                             0, T( 1 ), T( 0 ), packed->leaf_size, 0, (T *) packed->data, 0, 0, 0 };
+    convert_morton( &args, 0, num_tiles( packed->rows, packed->leaf_size ),
+                    num_tiles( packed->cols, packed->leaf_size ), 0, 0 );
+    return 0;
+}
+
+template <typename T>
+int mm_gemm_packed_b(char transa, int m, int n, int k,
+                     typename mm_types<T>::acc alpha, const T *A, int lda,
+                     const mm_packed *B,
+                     typename mm_types<T>::acc beta, typename mm_types<T>::acc *C, int ldc)
+{
+    if( !B || B->side != 'B' || B->dtype != mm_types<T>::dtype || B->rows != k || B->cols != n ) return -1;
+    return gemm_morton<T>( m, n, k, alpha, transa, A, lda, 0, 0, 'N', 0, 0, (const T *) B->data, B->occupancy,
+                           beta, C, ldc, B->leaf_size, 0 );
+}
+
+int mm_dgemm_packed_b(char transa, int m, int n, int k,
+                      double alpha, const double *A, int lda,
+                      const mm_packed *B,
+                      double beta, double *C, int ldc)
+{
+    return mm_gemm_packed_b<double>( transa, m, n, k, alpha, A, lda, B, beta, C, ldc );
+}
+
+template <typename U>
+int mm_gemm_packed(typename mm_identity<U>::type alpha, const mm_packed *A, const mm_packed *B,
+                   typename mm_identity<U>::type beta, U *C, int ldc)
+{
+    typedef typename operand_of<U>::type T;
+
+    if( !A || !B || A->side != 'A' || B->side != 'B' || A->cols != B->rows ) return -1;
+    if( A->dtype != mm_types<T>::dtype || B->dtype != mm_types<T>::dtype ) return -1;
+    if( A->leaf_size != B->leaf_size ) return -1;
+    return gemm_morton<T>( A->rows, B->cols, A->cols, alpha, 'N', 0, 0, (const T *) A->data, A->occupancy,
+                           'N', 0, 0, (const T *) B->data, B->occupancy, beta, C, ldc, A->leaf_size, 0 );
+}
+
+// problems of at most this many multiply-adds run whole on one worker in a batch
+#define BATCH_SERIAL_WORK ((double) 256 * 256 * 256)
+
+static inline size_t align64(size_t bytes) {
+    return ( bytes + 63 ) & ~(size_t) 63;
+}
+
+static inline int batch_leaf_size(mm_dtype dtype, int m, int n, int k) {
+    return engine_options.leaf_size > 0 ? engine_options.leaf_size : mm_tuned_leaf_size( dtype, m, n, k );
+}
+
+// Morton bytes of A, B and C of one batch problem, each 64-byte aligned
+template <typename T>
+static size_t batch_slot_bytes(const mm_gemm_problem<T> *p, int bs) {
+    return align64( morton_size( p->m, p->k, bs ) * sizeof(T) ) +
+           align64( morton_size( p->k, p->n, bs ) * sizeof(T) ) +
+           align64( morton_size( p->m, p->n, bs ) * sizeof(typename mm_types<T>::acc) );
+}
+
+// whether a batch problem takes the skinny path, as mm_gemm would send it
+template <typename T>
+static inline int batch_skinny(const mm_gemm_problem<T> *p, typename mm_types<T>::acc alpha) {
+    return p->k > 0 && alpha != typename mm_types<T>::acc( 0 ) && skinny_shape( p->m, p->n );
+}
+
+/*
+ * One small batch problem, packed into slot and multiplied by the serial
+ * recursion, or streamed by the skinny path with slot holding its copy of
+ * the small operand.  pack, unpack and the skinny path may still fork, so
+ * a waiting worker can pick up other problems meanwhile; slot must belong
+ * to this problem alone.  Returns 0, or -1 when memory runs out.
+ */
+template <typename T>
+static int batch_one(const mm_gemm_problem<T> *p, char transa, char transb, typename mm_types<T>::acc alpha,
+                     typename mm_types<T>::acc beta, char *slot) {
+
+    typedef typename mm_types<T>::acc acc_t;
+
+    if( batch_skinny( p, alpha ) )
+        return gemm_skinny_ab<T>( p->m, p->n, p->k, alpha, transa, p->A, p->lda, transb, p->B, p->ldb,
+                                  beta, p->C, p->ldc, 0, (T *) slot );
+
+    int bs = batch_leaf_size( mm_types<T>::dtype, p->m, p->n, p->k );
+    T *a_morton = (T *) slot;
+    T *b_morton = (T *)( slot + align64( morton_size( p->m, p->k, bs ) * sizeof(T) ) );
+    acc_t *c_morton = (acc_t *)( (char *) b_morton + align64( morton_size( p->k, p->n, bs ) * sizeof(T) ) );
+
+    memset( (void *) c_morton, 0, morton_size( p->m, p->n, bs ) * sizeof(acc_t) );
+    if( p->k > 0 && alpha != acc_t( 0 ) )
+    {
+        pack( PACK_A, transa, p->m, p->k, p->A, p->lda, a_morton, bs, 0 );
+        pack( PACK_B, transb, p->k, p->n, p->B, p->ldb, b_morton, bs, 0 );
+
+        mul_args<T> args;
+        args.kernel = mm_kernel_select<T>( bs, forced_kernel[0] ? forced_kernel : 0, 0 );
+        args.bs = bs;
+        args.tile = (size_t)bs * bs;
+        args.serial_tiles = 0;  // unused by mat_mul_serial
+        args.a_base = (const T *) a_morton;
+        args.b_base = (const T *) b_morton;
+        args.a_occupancy = 0;   // a scan would cost more than these small products save
+        args.b_occupancy = 0;
+        mat_mul_serial( (const T *) a_morton, (const T *) b_morton, c_morton,
+                        num_tiles( p->m, bs ), num_tiles( p->k, bs ), num_tiles( p->n, bs ), &args );
+    }
+    unpack_morton<acc_t>( p->m, p->n, alpha, c_morton, beta, p->C, p->ldc, bs, 0 );
+    return 0;
+}
+
+template <typename T>
+int mm_gemm_batch(char transa, char transb, typename mm_types<T>::acc alpha, typename mm_types<T>::acc beta,
+                  const mm_gemm_problem<T> *batch, int count)
+{
+    if( count < 0 || ( count > 0 && !batch ) ) return -1;
+
+    // check everything before touching any C
+    for( int i = 0; i < count; i++ )
+    {
+        const mm_gemm_problem<T> *p = &batch[i];
+        if( p->m < 0 || p->n < 0 || p->k < 0 || p->ldc < ( p->n > 1 ? p->n : 1 ) ) return -1;
+        if( p->lda < ( is_trans( transa ) ? p->m : p->k ) || p->ldb < ( is_trans( transb ) ? p->k : p->n ) )
+            return -1;
+    }
+
+    int *small = (int *) malloc( ( count > 0 ? count : 1 ) * sizeof(int) );
+    if( !small ) return -1;
+
+    // large problems get the whole machine one after another
+    int num_small = 0, failed = 0;
+    size_t slot_bytes = 0;
+    for( int i = 0; i < count; i++ )
+    {
+        const mm_gemm_problem<T> *p = &batch[i];
+        if( p->m == 0 || p->n == 0 ) continue;
+        if( (double) p->m * p->n * p->k > BATCH_SERIAL_WORK )
+        {
+            int bs = batch_leaf_size( mm_types<T>::dtype, p->m, p->n, p->k );
+            failed |= gemm_morton<T>( p->m, p->n, p->k, alpha, transa, p->A, p->lda, 0, 0,
+                                      transb, p->B, p->ldb, 0, 0, beta, p->C, p->ldc, bs, 0 );
+            continue;
+        }
+        size_t bytes = batch_skinny( p, alpha ) ?
+                       align64( skinny_scratch( p->m, p->n, p->k, transa, transb ) * sizeof(T) ) :
+                       batch_slot_bytes( p, batch_leaf_size( mm_types<T>::dtype, p->m, p->n, p->k ) );
+        if( bytes > slot_bytes ) slot_bytes = bytes;
+        small[num_small++] = i;
+    }
+
+    // small ones run in parallel across the batch, in one static chunk per
+    // worker that runs its problems in turn in the chunk's own workspace slot
+    if( num_small )
+    {
+        int chunks = mm_parallel_workers();
+        if( chunks > num_small ) chunks = num_small;
+        // skinny problems that use their operands in place need no slot at all
+        char *ws = slot_bytes ? (char *) mm_workspace_acquire( slot_bytes * chunks, 0 ) : 0;
+        if( slot_bytes && !ws )
+            failed = 1;
+        else
+        {
+            std::atomic<int> small_failed( 0 );
+            mm_parallel_for( 0, chunks, [&]( size_t c ) {
+                char *slot = ws + slot_bytes * c;
+                int first = (int)( (size_t) num_small * c / chunks );
+                int end = (int)( (size_t) num_small * ( c + 1 ) / chunks );
+                for( int s = first; s < end; s++ )
+                    if( batch_one( &batch[small[s]], transa, transb, alpha, beta, slot ) )
+                        small_failed.store( 1, std::memory_order_relaxed );
+            } );
+            if( small_failed.load() ) failed = 1;
+            mm_workspace_release( ws );
+        }
+    }
+
+    free( small );
+    return failed ? -1 : 0;
+}
+
+void mm_get_options(mm_options *options)
+{
+    *options = engine_options;
+}
+
+void mm_set_options(const mm_options *options)
+{
+    engine_options = *options;
+    if( engine_options.strassen_depth < 0 ) engine_options.strassen_depth = 0;
+    if( engine_options.leaf_size < 0 || engine_options.leaf_size > MAX_LEAF_SIZE ) engine_options.leaf_size = 0;
+    if( engine_options.spawn_grain < 0 ) engine_options.spawn_grain = 0;
+    if( engine_options.temp_depth < 0 ) engine_options.temp_depth = 0;
+    if( engine_options.numa_policy < MM_NUMA_DEFAULT || engine_options.numa_policy > MM_NUMA_PARTITIONED )
+        engine_options.numa_policy = MM_NUMA_DEFAULT;
+    if( engine_options.numa_nodes < 0 ) engine_options.numa_nodes = 0;
+    if( engine_options.huge_pages < MM_HUGE_PAGES_NONE || engine_options.huge_pages > MM_HUGE_PAGES_EXPLICIT )
+        engine_options.huge_pages = MM_HUGE_PAGES_TRANSPARENT;
+}
+
+const char *mm_set_kernel(const char *name)
+{
+    forced_kernel[0] = 0;
+    if( name ) strncat( forced_kernel, name, sizeof(forced_kernel) - 1 );
+    return mm_kernel_name<double>();
+}
+
+template <typename T>
+const char *mm_kernel_name(void)
+{
+    const char *name;
+    mm_kernel_select<T>( current_leaf_size(), forced_kernel[0] ? forced_kernel : 0, &name );
+    return name;
+}
+
+// explicit instantiations for the element types listed in mm_dac.h
+#define MM_INSTANTIATE_OPERAND(T) \
+    template void mm_pack_a<T>(char, int, int, const T *, int, T *); \
+    template void mm_pack_b<T>(char, int, int, const T *, int, T *); \
+    template void mm_zero<T>(T *, size_t); \
+    template void mm_multiply<T>(int, int, int, const T *, const T *, mm_types<T>::acc *); \
+    template void mm_multiply_occupied<T>(int, int, int, const T *, const uint32_t *, const T *, \
+                                          const uint32_t *, mm_types<T>::acc *); \
+    template void mm_occupancy_flags<T>(const T *, size_t, int, uint32_t *); \
+    template int mm_gemm<T>(char, char, int, int, int, mm_types<T>::acc, const T *, int, \
+                            const T *, int, mm_types<T>::acc, mm_types<T>::acc *, int); \
+    template int mm_gemm_epilogue<T>(char, char, int, int, int, mm_types<T>::acc, const T *, int, \
+                                     const T *, int, mm_types<T>::acc, mm_types<T>::acc *, int, \
+                                     const mm_epilogue<mm_types<T>::acc> *); \
+    template mm_packed *mm_pack<T>(char, char, int, int, const T *, int); \
+    template int mm_gemm_packed_b<T>(char, int, int, int, mm_types<T>::acc, const T *, int, \
+                                     const mm_packed *, mm_types<T>::acc, mm_types<T>::acc *, int); \
+    template const char *mm_kernel_name<T>(void); \
+    template int mm_packed_unpack<T>(const mm_packed *, T *, int); \
+    template int mm_gemm_batch<T>(char, char, mm_types<T>::acc, mm_types<T>::acc, \
+                                  const mm_gemm_problem<T> *, int);
+
+#define MM_INSTANTIATE_ACCUMULATOR(U) \
+    template void mm_unpack<U>(int, int, U, const U *, U, U *, int); \
+    template int mm_unpack_epilogue<U>(int, int, U, const U *, U, U *, int, const mm_epilogue<U> *); \
+    template int mm_gemm_packed<U>(U, const mm_packed *, const mm_packed *, U, U *, int);
+
+MM_INSTANTIATE_OPERAND(float)
+MM_INSTANTIATE_OPERAND(double)
+MM_INSTANTIATE_OPERAND(int8_t)
+MM_INSTANTIATE_OPERAND(std::complex<float>)
+MM_INSTANTIATE_OPERAND(std::complex<double>)
+
+MM_INSTANTIATE_ACCUMULATOR(float)
+MM_INSTANTIATE_ACCUMULATOR(double)
+MM_INSTANTIATE_ACCUMULATOR(int32_t)
+MM_INSTANTIATE_ACCUMULATOR(std::complex<float>)
+MM_INSTANTIATE_ACCUMULATOR(std::complex<double>)
+template void mm_zero<int32_t>(int32_t *, size_t);
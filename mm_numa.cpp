@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <numa.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_dac.h"
+#include "mm_numa.h"
+#include "mm_parallel.h"
+#include "mm_workspace.h"
+
+static size_t page_bytes(void)
+{
+    long page = sysconf( _SC_PAGESIZE );
+    return page > 0 ? (size_t) page : 4096;
+}
+
+// number of nodes the policies spread over, at most the configured ones
+static int policy_nodes(const mm_options *options)
+{
+    int nodes = numa_num_configured_nodes();
+    if( options->numa_nodes > 0 && options->numa_nodes < nodes ) nodes = options->numa_nodes;
+    return nodes > 0 ? nodes : 1;
+}
+
+static inline int split_tiles(int t)
+{
+    return (t + 1) >> 1;
+}
+
+/*
+ * Bind pieces of a Morton buffer to nodes.  The buffer is cut at quadrant
+ * boundaries, recursing until there are at least as many pieces as nodes,
+ * and piece i of p goes to node i * nodes / p.  Quadrants are in storage
+ * order, which for B ('B') runs down the columns first.
+ */
+static void bind_quadrants(char *base, int rt, int ct, size_t tile_bytes, char side,
+                           int first, int pieces, int nodes, size_t page)
+{
+    size_t bytes = (size_t) rt * ct * tile_bytes;
+    if( !bytes ) return;
+
+    if( pieces >= nodes || ( rt == 1 && ct == 1 ) )
+    {
+        // whole pages only; a page shared with the neighbour stays with it
+        size_t lo = ( (size_t) base + page - 1 ) & ~( page - 1 );
+        size_t hi = ( (size_t) base + bytes ) & ~( page - 1 );
+        if( hi > lo ) numa_tonode_memory( (void *) lo, hi - lo, first * nodes / pieces );
+        return;
+    }
+
+    int r0 = split_tiles( rt ), r1 = rt - r0;
+    int c0 = split_tiles( ct ), c1 = ct - c0;
+    int rows[4], cols[4];
+    if( side == 'B' )
+    {
+        rows[0] = r0; cols[0] = c0; rows[1] = r1; cols[1] = c0;
+        rows[2] = r0; cols[2] = c1; rows[3] = r1; cols[3] = c1;
+    }
+    else
+    {
+        rows[0] = r0; cols[0] = c0; rows[1] = r0; cols[1] = c1;
+        rows[2] = r1; cols[2] = c0; rows[3] = r1; cols[3] = c1;
+    }
+
+    for( int q = 0; q < 4; q++ )
+    {
+        bind_quadrants( base, rows[q], cols[q], tile_bytes, side, first * 4 + q, pieces * 4, nodes, page );
+        base += (size_t) rows[q] * cols[q] * tile_bytes;
+    }
+}
+
+void *mm_numa_alloc(char side, int rows, int cols, size_t elem_size, int bs)
+{
+    mm_options options;
+    mm_get_options( &options );
+
+    size_t tile_bytes = (size_t) bs * bs * elem_size;
+    int rt = ( rows + bs - 1 ) / bs, ct = ( cols + bs - 1 ) / bs;
+    size_t bytes = rows > 0 && cols > 0 ? (size_t) rt * ct * tile_bytes : 0;
+
+    // reused buffers keep the placement they were first given
+    int fresh;
+    char *buffer = (char *) mm_workspace_acquire( bytes, &fresh );
+    if( !buffer || !fresh ) return buffer;
+
+    if( bytes && numa_available() >= 0 )
+    {
+        int nodes = policy_nodes( &options );
+        switch( options.numa_policy )
+        {
+        case MM_NUMA_INTERLEAVE:
+        {
+            struct bitmask *mask = numa_allocate_nodemask();
+            for( int node = 0; node < nodes; node++ ) numa_bitmask_setbit( mask, node );
+            numa_interleave_memory( buffer, bytes, mask );
+            numa_bitmask_free( mask );
+            break;
+        }
+        case MM_NUMA_FIRST_TOUCH:
+            // pages go to the node of the worker that first writes them, which
+            // for Morton buffers is the parallel pack or mm_zero
+            numa_setlocal_memory( buffer, bytes );
+            break;
+        case MM_NUMA_PARTITIONED:
+            bind_quadrants( buffer, rt, ct, tile_bytes, side == 'B' || side == 'b' ? 'B' : 'A', 0, 1, nodes,
+                            page_bytes() );
+            break;
+        default:
+            break;
+        }
+    }
+
+    if( options.prefault ) mm_workspace_prefault( buffer, bytes );
+    return buffer;
+}
+
+void *mm_alloc_morton(char side, int rows, int cols, size_t elem_size)
+{
+    mm_options options;
+    mm_get_options( &options );
+    return mm_numa_alloc( side, rows, cols, elem_size,
+                          options.leaf_size > 0 ? options.leaf_size : MM_DEFAULT_LEAF_SIZE );
+}
+
+void mm_free_morton(void *buffer)
+{
+    mm_workspace_release( buffer );
+}
+
+int mm_numa_nodes(void)
+{
+    mm_options options;
+    mm_get_options( &options );
+    return numa_available() < 0 ? 1 : policy_nodes( &options );
+}
+
+int mm_numa_pin_worker(struct bitmask **saved)
+{
+    *saved = 0;
+    mm_options options;
+    mm_get_options( &options );
+    if( options.numa_policy != MM_NUMA_PARTITIONED || numa_available() < 0 ) return -1;
+
+    int nodes = policy_nodes( &options );
+    int id = mm_parallel_worker_id(), workers = mm_parallel_workers();
+    if( id == 0 || workers <= 1 )
+    {
+        int cpu = sched_getcpu();
+        int node = cpu < 0 ? -1 : numa_node_of_cpu( cpu );
+        return node < 0 ? 0 : node % nodes;
+    }
+
+    int node = (int)( (long) id * nodes / workers );
+    struct bitmask *cpus = numa_allocate_cpumask();
+    if( numa_sched_getaffinity( 0, cpus ) > 0 && numa_run_on_node( node ) == 0 )
+        *saved = cpus;
+    else
+        numa_free_cpumask( cpus );
+    return node;
+}
+
+void mm_numa_unpin_worker(struct bitmask *saved)
+{
+    if( !saved ) return;
+    numa_sched_setaffinity( 0, saved );
+    numa_free_cpumask( saved );
+}
+
+int mm_numa_piece_node(int index, int pieces)
+{
+    // bind_quadrants stops cutting at the first level with a piece per node
+    int nodes = mm_numa_nodes();
+    while( pieces >= 4 * nodes )
+    {
+        index /= 4;
+        pieces /= 4;
+    }
+    return (int)( (long) index * nodes / pieces );
+}
+
+static const char *policy_names[] = { "default", "interleave", "first-touch", "partitioned" };
+
+const char *mm_numa_policy_name(int policy)
+{
+    return policy >= 0 && policy < 4 ? policy_names[policy] : "unknown";
+}
+
+int mm_numa_policy_from_name(const char *name)
+{
+    for( int policy = 0; policy < 4; policy++ )
+        if( !strcmp( name, policy_names[policy] ) ) return policy;
+    return -1;
+}
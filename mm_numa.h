@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_NUMA_H_
+#define _MM_NUMA_H_
+
+#include <stddef.h>
+
+/* Number of NUMA nodes the policies spread buffers over, at least 1. */
+int mm_numa_nodes(void);
+
+struct bitmask;
+
+/*
+ * Under MM_NUMA_PARTITIONED, the node whose pieces of C the calling worker
+ * multiplies first.  Workers other than worker 0, the caller of the
+ * multiply, are spread evenly over the nodes and pinned to theirs; worker 0
+ * keeps its placement and reports the node it runs on.  The threads belong
+ * to the parallel runtime, so the affinity a worker had is returned in
+ * *saved, or 0 when it was left alone, and must be handed back to
+ * mm_numa_unpin_worker before the worker runs anything else.  Returns -1
+ * under other policies or when NUMA is unavailable.
+ */
+int mm_numa_pin_worker(struct bitmask **saved);
+
+/* Restore the affinity saved by mm_numa_pin_worker. */
+void mm_numa_unpin_worker(struct bitmask *saved);
+
+/*
+ * The node that piece index of pieces, a power of four, of a Morton buffer
+ * cut at quadrant boundaries in storage order is bound to under
+ * MM_NUMA_PARTITIONED.  It never decreases with index.
+ */
+int mm_numa_piece_node(int index, int pieces);
+
+/*
+ * mm_alloc_morton for leaf size bs: an arena buffer placed by the current
+ * NUMA policy when it is freshly mapped.  Release with mm_workspace_release.
+ */
+void *mm_numa_alloc(char side, int rows, int cols, size_t elem_size, int bs);
+
+#endif  // _MM_NUMA_H_
@@ -0,0 +1,456 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+/*
+ * Out-of-core multiply on Morton buffers kept in files.  Every quadrant of
+ * a Morton buffer is contiguous, so the recursion that the in-memory engine
+ * runs on tiles can run here on byte ranges of memory-mapped files: it
+ * splits A, B and C into quadrants until one triple fits in half the memory
+ * budget and hands each triple to mm_multiply.  While one triple is being
+ * multiplied a helper thread reads the next one in, and each block of C is
+ * written back as soon as its last product is added.  A and B are scanned
+ * for all-zero tiles once up front; triples with an all-zero A or B block
+ * are never read, and the rest get their slice of the scan.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mm_dac.h"
+#include "mm_packed.h"
+
+/*
+ * One in-core multiply: C block += A block * B block, all three given as
+ * element offsets into their Morton buffers.  last is set when no later
+ * task adds into this block of C, so it can be written back afterwards.
+ */
+typedef struct {
+    size_t a, b, c;
+    int mt, kt, nt;
+    int last;
+} ooc_task;
+
+typedef struct {
+    ooc_task *tasks;
+    int count;
+    int capacity;
+} ooc_plan;
+
+// byte range of a mapping that a task reads or writes
+typedef struct {
+    const char *start;
+    size_t bytes;
+} ooc_range;
+
+// what the prefetch thread brings in: A, B and C of the next task
+typedef struct {
+    pthread_t thread;
+    ooc_range ranges[3];
+} ooc_prefetch;
+
+static size_t page_bytes(void)
+{
+    long page = sysconf( _SC_PAGESIZE );
+    return page > 0 ? (size_t) page : 4096;
+}
+
+// half the free memory, the budget used when the caller gives none
+static size_t default_budget(void)
+{
+    long pages = sysconf( _SC_AVPHYS_PAGES );
+    if( pages <= 0 ) return 0;
+    return (size_t) pages * page_bytes() / 2;
+}
+
+static int plan_push( ooc_plan *plan, const ooc_task *task )
+{
+    if( plan->count == plan->capacity )
+    {
+        int capacity = plan->capacity ? 2 * plan->capacity : 64;
+        ooc_task *tasks = (ooc_task *) realloc( plan->tasks, capacity * sizeof(ooc_task) );
+        if( !tasks ) return -1;
+        plan->tasks = tasks;
+        plan->capacity = capacity;
+    }
+    plan->tasks[plan->count++] = *task;
+    return 0;
+}
+
+/*
+ * Split the multiply the way mat_mul_serial does, C quadrant by C quadrant
+ * and the k0 half before the k1 half, until a task's three blocks take at
+ * most limit bytes.  The quadrant offsets are those of split_quadrants.
+ */
+static int plan_tasks( ooc_plan *plan, size_t a, size_t b, size_t c, int mt, int kt, int nt,
+                       size_t tile, size_t elem_size, size_t acc_size, size_t limit, int last )
+{
+    size_t bytes = ( (size_t) mt * kt + (size_t) kt * nt ) * tile * elem_size +
+                   (size_t) mt * nt * tile * acc_size;
+    if( bytes <= limit || ( mt == 1 && kt == 1 && nt == 1 ) )
+    {
+        ooc_task task = { a, b, c, mt, kt, nt, last };
+        return plan_push( plan, &task );
+    }
+
+    int m0 = ( mt + 1 ) >> 1, m1 = mt - m0;
+    int k0 = ( kt + 1 ) >> 1, k1 = kt - k0;
+    int n0 = ( nt + 1 ) >> 1, n1 = nt - n0;
+
+    size_t a_quad[4], b_quad[4], c_quad[4];
+    a_quad[0] = a;
+    a_quad[1] = a + (size_t) m0 * k0 * tile;
+    a_quad[2] = a + (size_t) m0 * kt * tile;
+    a_quad[3] = a_quad[2] + (size_t) m1 * k0 * tile;
+    b_quad[0] = b;
+    b_quad[1] = b + (size_t) kt * n0 * tile;
+    b_quad[2] = b + (size_t) k0 * n0 * tile;
+    b_quad[3] = b_quad[1] + (size_t) k0 * n1 * tile;
+    c_quad[0] = c;
+    c_quad[1] = c + (size_t) m0 * n0 * tile;
+    c_quad[2] = c + (size_t) m0 * nt * tile;
+    c_quad[3] = c_quad[2] + (size_t) m1 * n0 * tile;
+
+    for( int quad = 0; quad < 4; quad++ )
+    {
+        int r = quad >> 1, col = quad & 1;
+        int qm = r ? m1 : m0, qn = col ? n1 : n0;
+        if( !qm || !qn ) continue;
+
+        if( plan_tasks( plan, a_quad[2 * r], b_quad[col], c_quad[quad], qm, k0, qn,
+                        tile, elem_size, acc_size, limit, last && !k1 ) )
+            return -1;
+        if( k1 && plan_tasks( plan, a_quad[2 * r + 1], b_quad[2 + col], c_quad[quad], qm, k1, qn,
+                              tile, elem_size, acc_size, limit, last ) )
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Whole pages of range, rounded out (to read or sync all of it) or in (to
+ * drop it without touching pages that neighbouring ranges share).
+ */
+static void page_span( const ooc_range *range, int outward, char **start, size_t *bytes )
+{
+    size_t page = page_bytes();
+    uintptr_t begin = (uintptr_t) range->start, end = begin + range->bytes;
+    if( outward )
+    {
+        begin &= ~( page - 1 );
+        end = ( end + page - 1 ) & ~( page - 1 );
+    }
+    else
+    {
+        begin = ( begin + page - 1 ) & ~( page - 1 );
+        end &= ~( page - 1 );
+    }
+    *start = (char *) begin;
+    *bytes = end > begin ? end - begin : 0;
+}
+
+// start the reads and then touch one byte per page so the next task does not fault
+static void *prefetch_main( void *arg )
+{
+    ooc_prefetch *prefetch = (ooc_prefetch *) arg;
+    size_t page = page_bytes();
+    unsigned sum = 0;
+
+    for( int i = 0; i < 3; i++ )
+    {
+        char *start;
+        size_t bytes;
+        page_span( &prefetch->ranges[i], 1, &start, &bytes );
+        if( bytes ) madvise( start, bytes, MADV_WILLNEED );
+    }
+    for( int i = 0; i < 3; i++ )
+    {
+        const volatile char *p = prefetch->ranges[i].start;
+        for( size_t off = 0; off < prefetch->ranges[i].bytes; off += page )
+            sum += p[off];
+    }
+    return (void *)(uintptr_t) sum;
+}
+
+static void drop_range( const ooc_range *range )
+{
+    char *start;
+    size_t bytes;
+    page_span( range, 0, &start, &bytes );
+    if( bytes ) madvise( start, bytes, MADV_DONTNEED );
+}
+
+// queue the writeback of a finished block of C and let its pages go
+static void write_back( const ooc_range *range )
+{
+    char *start;
+    size_t bytes;
+    page_span( range, 1, &start, &bytes );
+    if( bytes ) msync( start, bytes, MS_ASYNC );
+    drop_range( range );
+}
+
+static int same_range( const ooc_range *x, const ooc_range *y )
+{
+    return x->start == y->start && x->bytes == y->bytes;
+}
+
+// the A, B and C blocks of task
+template <typename T>
+static void task_ranges( const ooc_task *task, const T *a_morton, const T *b_morton,
+                         const typename mm_types<T>::acc *c_morton, size_t tile, ooc_range *ranges )
+{
+    ranges[0].start = (const char *)( a_morton + task->a );
+    ranges[0].bytes = (size_t) task->mt * task->kt * tile * sizeof(T);
+    ranges[1].start = (const char *)( b_morton + task->b );
+    ranges[1].bytes = (size_t) task->kt * task->nt * tile * sizeof(T);
+    ranges[2].start = (const char *)( c_morton + task->c );
+    ranges[2].bytes = (size_t) task->mt * task->nt * tile * sizeof(*c_morton);
+}
+
+/*
+ * The occupancy of the tiles mapped tiles of width bs at z (see
+ * mm_packed.h), read window bytes at a time and let go again, or 0 when
+ * out of memory.
+ */
+template <typename T>
+static uint32_t *scan_mapped( const T *z, size_t tiles, int bs, size_t window )
+{
+    uint32_t *occupancy = (uint32_t *) malloc( ( tiles + 1 ) * sizeof(uint32_t) );
+    if( !occupancy ) return 0;
+
+    size_t tile = (size_t) bs * bs;
+    size_t step = window / ( tile * sizeof(T) );
+    if( step < 1 ) step = 1;
+    for( size_t t = 0; t < tiles; t += step )
+    {
+        size_t count = tiles - t < step ? tiles - t : step;
+        ooc_range range = { (const char *)( z + t * tile ), count * tile * sizeof(T) };
+        char *start;
+        size_t bytes;
+        page_span( &range, 1, &start, &bytes );
+        if( bytes ) madvise( start, bytes, MADV_WILLNEED );
+        mm_occupancy_flags( z + t * tile, count, bs, occupancy + t );
+        drop_range( &range );
+    }
+    mm_occupancy_counts( occupancy, tiles );
+    return occupancy;
+}
+
+// whether the count tiles from tile first on are all zero, never with no occupancy
+static int block_empty( const uint32_t *occupancy, size_t first, size_t count )
+{
+    return occupancy && occupancy[first + count] == occupancy[first];
+}
+
+/*
+ * c_morton += a_morton * b_morton on buffers in file mappings, streaming
+ * the plan's tasks through at most budget bytes of memory.  a_occupancy and
+ * b_occupancy are those of the whole operands, or 0 to scan task by task.
+ */
+template <typename T>
+static int multiply_mapped( int m, int n, int k, const T *a_morton, const uint32_t *a_occupancy,
+                            const T *b_morton, const uint32_t *b_occupancy,
+                            typename mm_types<T>::acc *c_morton, int bs, size_t budget )
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    int mt = ( m + bs - 1 ) / bs, kt = ( k + bs - 1 ) / bs, nt = ( n + bs - 1 ) / bs;
+    size_t tile = (size_t) bs * bs;
+
+    // half of the budget for the task being multiplied, half for the one being read
+    ooc_plan plan = { 0, 0, 0 };
+    if( plan_tasks( &plan, 0, 0, 0, mt, kt, nt, tile, sizeof(T), sizeof(acc_t), budget / 2, 1 ) )
+    {
+        free( plan.tasks );
+        return -1;
+    }
+
+    // an all-zero A or B block adds nothing to C; a dropped last task hands
+    // the write-back of its C block to the latest kept task on that block
+    int kept = 0;
+    for( int i = 0; i < plan.count; i++ )
+    {
+        const ooc_task *task = &plan.tasks[i];
+        if( block_empty( a_occupancy, task->a / tile, (size_t) task->mt * task->kt ) ||
+            block_empty( b_occupancy, task->b / tile, (size_t) task->kt * task->nt ) )
+        {
+            for( int j = kept - 1; task->last && j >= 0; j-- )
+                if( plan.tasks[j].c == task->c && plan.tasks[j].mt == task->mt && plan.tasks[j].nt == task->nt )
+                {
+                    plan.tasks[j].last = 1;
+                    break;
+                }
+            continue;
+        }
+        plan.tasks[kept++] = *task;
+    }
+    plan.count = kept;
+
+    ooc_prefetch prefetch;
+    int prefetching = 0;
+    for( int i = 0; i < plan.count; i++ )
+    {
+        const ooc_task *task = &plan.tasks[i];
+        ooc_range current[3], next[3] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+        task_ranges( task, a_morton, b_morton, c_morton, tile, current );
+
+        if( i + 1 < plan.count )
+        {
+            // blocks the next task shares with this one are resident already
+            task_ranges( &plan.tasks[i + 1], a_morton, b_morton, c_morton, tile, next );
+            for( int r = 0; r < 3; r++ )
+            {
+                prefetch.ranges[r] = next[r];
+                if( same_range( &current[r], &next[r] ) ) prefetch.ranges[r].bytes = 0;
+            }
+            prefetching = !pthread_create( &prefetch.thread, 0, prefetch_main, &prefetch );
+        }
+
+        mm_multiply_occupied<T>( task->mt * bs, task->nt * bs, task->kt * bs,
+                                 a_morton + task->a, a_occupancy ? a_occupancy + task->a / tile : 0,
+                                 b_morton + task->b, b_occupancy ? b_occupancy + task->b / tile : 0,
+                                 c_morton + task->c );
+
+        if( prefetching ) pthread_join( prefetch.thread, 0 );
+        prefetching = 0;
+
+        if( task->last ) write_back( &current[2] );
+        for( int r = 0; r < 2; r++ )
+            if( !same_range( &current[r], &next[r] ) ) drop_range( &current[r] );
+    }
+
+    free( plan.tasks );
+    return 0;
+}
+
+/*
+ * Map bytes of path from offset on, creating and extending the file when
+ * writable.  The pointer returned is to offset itself; free the mapping
+ * with unmap_file.
+ */
+static void *map_file( const char *path, size_t offset, size_t bytes, int writable )
+{
+    int fd = open( path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644 );
+    if( fd < 0 ) return 0;
+
+    struct stat st;
+    if( fstat( fd, &st ) || ( (size_t) st.st_size < offset + bytes &&
+                              ( !writable || ftruncate( fd, (off_t)( offset + bytes ) ) ) ) )
+    {
+        close( fd );
+        return 0;
+    }
+
+    size_t base = offset & ~( page_bytes() - 1 );
+    void *map = mmap( 0, offset - base + bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                      fd, (off_t) base );
+    close( fd );
+    if( map == MAP_FAILED ) return 0;
+
+    // only the prefetch thread decides what is read ahead
+    madvise( map, offset - base + bytes, MADV_RANDOM );
+    return (char *) map + ( offset - base );
+}
+
+static void unmap_file( void *data, size_t offset, size_t bytes )
+{
+    if( !data ) return;
+    size_t base = offset & ~( page_bytes() - 1 );
+    munmap( (char *) data - ( offset - base ), offset - base + bytes );
+}
+
+/*
+ * Where the Morton buffer of an operand file starts: after the header of a
+ * Morton file that holds the expected matrix, at 0 in a raw file, and -1
+ * for a Morton file that holds anything else.
+ */
+static long operand_offset( const char *path, char side, mm_dtype dtype, int rows, int cols, int bs )
+{
+    mm_file_header header;
+    int found = mm_file_read_header( path, &header );
+    if( found <= 0 ) return found;
+    if( header.side != (uint32_t) side || header.dtype != (uint32_t) dtype || header.rows != (uint64_t) rows ||
+        header.cols != (uint64_t) cols || header.leaf_size != (uint32_t) bs ) return -1;
+    return header.data_offset;
+}
+
+template <typename T>
+int mm_multiply_files(int m, int n, int k, const char *a_path, const char *b_path,
+                      const char *c_path, size_t budget)
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    if( m < 0 || n < 0 || k < 0 || !a_path || !b_path || !c_path ) return -1;
+    if( m == 0 || n == 0 ) return 0;
+
+    mm_options options;
+    mm_get_options( &options );
+    int bs = options.leaf_size > 0 ? options.leaf_size : MM_DEFAULT_LEAF_SIZE;
+    size_t tile = (size_t) bs * bs;
+    size_t a_bytes = (size_t)( ( m + bs - 1 ) / bs ) * ( ( k + bs - 1 ) / bs ) * tile * sizeof(T);
+    size_t b_bytes = (size_t)( ( k + bs - 1 ) / bs ) * ( ( n + bs - 1 ) / bs ) * tile * sizeof(T);
+    size_t c_bytes = (size_t)( ( m + bs - 1 ) / bs ) * ( ( n + bs - 1 ) / bs ) * tile * sizeof(acc_t);
+    if( budget == 0 ) budget = default_budget();
+
+    acc_t *c_morton = (acc_t *) map_file( c_path, 0, c_bytes, 1 );
+    if( !c_morton ) return -1;
+    if( k == 0 )
+    {
+        unmap_file( c_morton, 0, c_bytes );
+        return 0;
+    }
+
+    long a_offset = operand_offset( a_path, 'A', mm_types<T>::dtype, m, k, bs );
+    long b_offset = operand_offset( b_path, 'B', mm_types<T>::dtype, k, n, bs );
+    const T *a_morton = 0, *b_morton = 0;
+    if( a_offset >= 0 ) a_morton = (const T *) map_file( a_path, a_offset, a_bytes, 0 );
+    if( b_offset >= 0 ) b_morton = (const T *) map_file( b_path, b_offset, b_bytes, 0 );
+    int result = -1;
+    if( a_morton && b_morton )
+    {
+        // one scan of each operand up front instead of one per task that reads it
+        uint32_t *a_occupancy = scan_mapped( a_morton, a_bytes / ( tile * sizeof(T) ), bs, budget / 2 );
+        uint32_t *b_occupancy = scan_mapped( b_morton, b_bytes / ( tile * sizeof(T) ), bs, budget / 2 );
+        result = multiply_mapped<T>( m, n, k, a_morton, a_occupancy, b_morton, b_occupancy, c_morton, bs, budget );
+        free( a_occupancy );
+        free( b_occupancy );
+    }
+
+    unmap_file( (void *) a_morton, a_offset, a_bytes );
+    unmap_file( (void *) b_morton, b_offset, b_bytes );
+    unmap_file( c_morton, 0, c_bytes );
+    return result;
+}
+
+#define MM_INSTANTIATE_OOC(T) \
+    template int mm_multiply_files<T>(int, int, int, const char *, const char *, const char *, size_t);
+
+MM_INSTANTIATE_OOC(float)
+MM_INSTANTIATE_OOC(double)
+MM_INSTANTIATE_OOC(int8_t)
+MM_INSTANTIATE_OOC(std::complex<float>)
+MM_INSTANTIATE_OOC(std::complex<double>)
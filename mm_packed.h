@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_PACKED_H_
+#define _MM_PACKED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mm_dac.h"
+
+/*
+ * A matrix packed once into Morton-Z order.  It is never written after
+ * mm_pack returns, so any number of multiplies may read it concurrently.
+ * data is an arena buffer, or points into a mapping of a Morton file of
+ * mapped bytes starting at map when the handle came from mm_packed_map.
+ * occupancy counts the tiles that hold a nonzero, so multiplies can skip
+ * all-zero quadrants without looking at them; mm_packed_map scans a file's
+ * tiles for it once.
+ */
+struct mm_packed {
+    char side;      // 'A' or 'B'
+    mm_dtype dtype;
+    int rows;
+    int cols;
+    int leaf_size;  // leaf tile width of the layout
+    void *data;
+    void *map;
+    size_t mapped;
+    uint32_t *occupancy;    // of data as mm_pack records it, 0 if it could not be had
+};
+
+/*
+ * The occupancy of a Morton buffer: entry t counts the tiles before tile t
+ * that hold a nonzero and the last entry all of them, so any run of tiles,
+ * such as a quadrant, is all zero when its two ends count the same.  A
+ * slice of it starting at tile t is the occupancy of the buffer from tile
+ * t on.  mm_occupancy_flags sets flags[t] to 1 for each of the tiles
+ * leaf tiles of width bs at z that holds a nonzero and to 0 otherwise, and
+ * mm_occupancy_counts turns the tiles + 1 entries that hold the flags of
+ * a whole buffer into its occupancy.
+ */
+template <typename T>
+void mm_occupancy_flags(const T *z, size_t tiles, int bs, uint32_t *flags);
+void mm_occupancy_counts(uint32_t *occupancy, size_t tiles);
+
+/*
+ * mm_multiply given the occupancy of a_morton and b_morton (either 0 to
+ * scan that operand here), e.g. slices of the occupancy of the buffers
+ * they are quadrants of.
+ */
+template <typename T>
+void mm_multiply_occupied(int m, int n, int k, const T *a_morton, const uint32_t *a_occupancy,
+                          const T *b_morton, const uint32_t *b_occupancy, typename mm_types<T>::acc *c_morton);
+
+/*
+ * Layout of a Morton file: this header, then from data_offset on the Morton
+ * buffer exactly as it is in memory.  The data starts on a page boundary so
+ * it can be mapped in place.  Fields are in the byte order of the host that
+ * wrote the file; a reader on the other byte order sees a bad version.
+ */
+#define MM_FILE_MAGIC "MMDACMZ"
+#define MM_FILE_VERSION 1
+#define MM_FILE_DATA_OFFSET 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_offset;
+    uint32_t dtype;         // mm_dtype
+    uint32_t side;          // 'A' or 'B'
+    uint32_t leaf_size;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t data_bytes;
+    uint64_t checksum;      // of the data bytes, see mm_file_checksum
+} mm_file_header;
+
+// bytes of one element of dtype, 0 if unknown
+size_t mm_dtype_size(mm_dtype dtype);
+
+/*
+ * Read the header of path.  Returns 1 for a valid Morton file, 0 for a file
+ * without the magic (a raw buffer) and -1 when it cannot be read or the
+ * header is inconsistent.
+ */
+int mm_file_read_header(const char *path, mm_file_header *header);
+
+// 64-bit checksum of bytes bytes, computed by parallel workers
+uint64_t mm_file_checksum(const void *data, size_t bytes);
+
+#endif  // _MM_PACKED_H_
@@ -0,0 +1,595 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Cilk Plus and OpenMP are optional: MM_USE_CILK and -fopenmp build them in.
+#ifdef MM_USE_CILK
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mm_dac.h"
+#include "mm_parallel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() std::this_thread::yield()
+#endif
+
+// chunk size of a loop with grain 0, as cilk_for picks it
+static size_t default_grain(size_t count, int workers)
+{
+    size_t grain = ( count + 8 * (size_t) workers - 1 ) / ( 8 * (size_t) workers );
+    return grain < 1 ? 1 : grain > 2048 ? 2048 : grain;
+}
+
+static void serial_invoke(const mm_task *tasks, int count)
+{
+    for( int i = 0; i < count; i++ ) tasks[i].run( tasks[i].body );
+}
+
+static void serial_loop(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body)
+{
+    if( !grain ) grain = end - begin;
+    for( size_t lo = begin; lo < end; lo += grain ) run( body, lo, end - lo < grain ? end : lo + grain );
+}
+
+static int serial_workers(void) { return 1; }
+static int serial_worker_id(void) { return 0; }
+static int serial_set_workers(int) { return 1; }
+
+static const mm_backend serial_backend = {
+    "serial", serial_invoke, serial_loop, serial_workers, serial_worker_id, serial_set_workers
+};
+
+#ifdef MM_USE_CILK
+// a spawned child runs first on the spawning worker, so the last task goes first
+static void cilk_invoke(const mm_task *tasks, int count)
+{
+    if( count == 1 )
+    {
+        tasks[0].run( tasks[0].body );
+        return;
+    }
+    cilk_spawn tasks[count - 1].run( tasks[count - 1].body );
+    for( int i = 0; i < count - 2; i++ ) cilk_spawn tasks[i].run( tasks[i].body );
+    tasks[count - 2].run( tasks[count - 2].body );
+    cilk_sync;
+}
+
+static void cilk_loop(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body)
+{
+    if( !grain ) grain = default_grain( end - begin, __cilkrts_get_nworkers() );
+    size_t chunks = ( end - begin + grain - 1 ) / grain;
+    cilk_for( size_t c = 0; c < chunks; c++ )
+    {
+        size_t lo = begin + c * grain;
+        run( body, lo, end - lo < grain ? end : lo + grain );
+    }
+}
+
+static int cilk_workers(void) { return __cilkrts_get_nworkers(); }
+static int cilk_worker_id(void) { return __cilkrts_get_worker_number(); }
+
+// the runtime only takes a new worker count while it is stopped
+static int cilk_set_workers(int workers)
+{
+    char value[16];
+    if( workers > 0 && workers != __cilkrts_get_nworkers() )
+    {
+        __cilkrts_end_cilk();
+        snprintf( value, sizeof(value), "%d", workers );
+        if( __cilkrts_set_param( "nworkers", value ) != 0 )
+            fprintf( stderr, "Could not set %d workers\n", workers );
+    }
+    return __cilkrts_get_nworkers();
+}
+
+static const mm_backend cilk_backend = {
+    "cilk", cilk_invoke, cilk_loop, cilk_workers, cilk_worker_id, cilk_set_workers
+};
+#endif
+
+#ifdef _OPENMP
+static void omp_tasks(const mm_task *tasks, int count)
+{
+    for( int i = 0; i < count - 1; i++ )
+    {
+        const mm_task *task = &tasks[i];
+        #pragma omp task firstprivate(task)
+        task->run( task->body );
+    }
+    tasks[count - 1].run( tasks[count - 1].body );
+    #pragma omp taskwait
+}
+
+// a fork outside any parallel region starts a team and runs from one member
+static void omp_invoke(const mm_task *tasks, int count)
+{
+    if( omp_in_parallel() )
+    {
+        omp_tasks( tasks, count );
+        return;
+    }
+    #pragma omp parallel
+    #pragma omp single
+    omp_tasks( tasks, count );
+}
+
+static void omp_chunks(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body)
+{
+    size_t chunks = ( end - begin + grain - 1 ) / grain;
+    #pragma omp taskloop grainsize(1)
+    for( size_t c = 0; c < chunks; c++ )
+    {
+        size_t lo = begin + c * grain;
+        run( body, lo, end - lo < grain ? end : lo + grain );
+    }
+}
+
+static void omp_loop(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body)
+{
+    if( !grain ) grain = default_grain( end - begin, omp_get_max_threads() );
+    if( omp_in_parallel() )
+    {
+        omp_chunks( begin, end, grain, run, body );
+        return;
+    }
+    #pragma omp parallel
+    #pragma omp single
+    omp_chunks( begin, end, grain, run, body );
+}
+
+static int omp_workers(void) { return omp_get_max_threads(); }
+static int omp_worker_id(void) { return omp_get_thread_num(); }
+
+static int omp_set_workers(int workers)
+{
+    if( workers > 0 ) omp_set_num_threads( workers );
+    return omp_get_max_threads();
+}
+
+static const mm_backend omp_backend = {
+    "openmp", omp_invoke, omp_loop, omp_workers, omp_worker_id, omp_set_workers
+};
+#endif
+
+/*
+ * The threads backend: one Chase-Lev deque per worker (Le et al., "Correct
+ * and efficient work-stealing for weak memory models", PPoPP 2013).  A
+ * worker pushes the tasks it forks at the bottom of its own deque and pops
+ * them back from there, while idle workers steal from the top of a random
+ * victim.  A worker waiting for its forked tasks keeps popping and
+ * stealing, so no worker blocks while there is work.
+ *
+ * Threads outside the pool hand their fork to the pool as a root job and
+ * sleep until it finishes.  Workers that find nothing to do spin for a
+ * while and then sleep until a push wakes them.
+ */
+#define POOL_DEQUE_SIZE 4096
+#define POOL_SPINS 4096
+
+typedef struct pool_job {
+    const mm_task *task;
+    std::atomic<int> *pending;
+    int root;
+} pool_job;
+
+struct pool_deque {
+    std::atomic<long> top;
+    char pad[64];
+    std::atomic<long> bottom;
+    std::atomic<pool_job *> jobs[POOL_DEQUE_SIZE];
+};
+
+struct pool_worker {
+    pool_deque deque;
+    int index;
+    unsigned seed;
+    std::thread thread;
+};
+
+static std::mutex pool_lock;            // starts and stops the pool
+static std::vector<pool_worker *> pool;
+static std::atomic<int> pool_size(0);
+static std::atomic<int> pool_stop(0);
+static int pool_wanted;                 // workers of the next start, 0 for all CPUs
+static thread_local pool_worker *pool_self;
+
+static std::mutex root_lock;            // guards roots and wakes root callers
+static std::condition_variable root_done;
+static std::deque<pool_job *> roots;
+static std::atomic<int> root_count(0);
+
+static std::mutex sleep_lock;
+static std::condition_variable sleep_wake;
+static std::atomic<int> sleepers(0);
+
+static int deque_push(pool_deque *d, pool_job *job)
+{
+    long b = d->bottom.load( std::memory_order_relaxed );
+    long t = d->top.load( std::memory_order_acquire );
+    if( b - t >= POOL_DEQUE_SIZE ) return 0;
+    d->jobs[b & ( POOL_DEQUE_SIZE - 1 )].store( job, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    d->bottom.store( b + 1, std::memory_order_relaxed );
+    return 1;
+}
+
+static pool_job *deque_pop(pool_deque *d)
+{
+    long b = d->bottom.load( std::memory_order_relaxed ) - 1;
+    d->bottom.store( b, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    long t = d->top.load( std::memory_order_relaxed );
+    pool_job *job = 0;
+    if( t <= b )
+    {
+        job = d->jobs[b & ( POOL_DEQUE_SIZE - 1 )].load( std::memory_order_relaxed );
+        if( t == b )
+        {
+            // the last job: race the thieves for it
+            if( !d->top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed ) )
+                job = 0;
+            d->bottom.store( b + 1, std::memory_order_relaxed );
+        }
+    }
+    else d->bottom.store( b + 1, std::memory_order_relaxed );
+    return job;
+}
+
+static pool_job *deque_steal(pool_deque *d)
+{
+    long t = d->top.load( std::memory_order_acquire );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    long b = d->bottom.load( std::memory_order_acquire );
+    if( t >= b ) return 0;
+    pool_job *job = d->jobs[t & ( POOL_DEQUE_SIZE - 1 )].load( std::memory_order_relaxed );
+    if( !d->top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+        return 0;
+    return job;
+}
+
+static int deque_empty(pool_deque *d)
+{
+    return d->top.load( std::memory_order_acquire ) >= d->bottom.load( std::memory_order_acquire );
+}
+
+static void wake_sleepers(void)
+{
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if( sleepers.load( std::memory_order_relaxed ) > 0 )
+    {
+        std::lock_guard<std::mutex> lock( sleep_lock );
+        sleep_wake.notify_one();
+    }
+}
+
+static void run_job(pool_job *job)
+{
+    job->task->run( job->task->body );
+    if( job->root )
+    {
+        std::lock_guard<std::mutex> lock( root_lock );
+        job->pending->fetch_sub( 1, std::memory_order_release );
+        root_done.notify_all();
+    }
+    else job->pending->fetch_sub( 1, std::memory_order_release );
+}
+
+static pool_job *take_root(void)
+{
+    if( root_count.load( std::memory_order_acquire ) == 0 ) return 0;
+    std::lock_guard<std::mutex> lock( root_lock );
+    if( roots.empty() ) return 0;
+    pool_job *job = roots.front();
+    roots.pop_front();
+    root_count.fetch_sub( 1, std::memory_order_relaxed );
+    return job;
+}
+
+// one round over the other workers from a random start, then the roots
+static pool_job *find_work(pool_worker *self)
+{
+    int size = pool_size.load( std::memory_order_relaxed );
+    self->seed = self->seed * 1103515245u + 12345u;
+    int start = ( self->seed >> 16 ) % size;
+    for( int i = 0; i < size; i++ )
+    {
+        pool_worker *victim = pool[( start + i ) % size];
+        if( victim == self ) continue;
+        pool_job *job = deque_steal( &victim->deque );
+        if( job ) return job;
+    }
+    return take_root();
+}
+
+static int work_visible(void)
+{
+    if( root_count.load( std::memory_order_acquire ) > 0 ) return 1;
+    for( int i = 0; i < pool_size.load( std::memory_order_relaxed ); i++ )
+        if( !deque_empty( &pool[i]->deque ) ) return 1;
+    return 0;
+}
+
+static void worker_loop(pool_worker *self)
+{
+    pool_self = self;
+    int idle = 0;
+    while( !pool_stop.load( std::memory_order_acquire ) )
+    {
+        pool_job *job = find_work( self );
+        if( job )
+        {
+            run_job( job );
+            idle = 0;
+            continue;
+        }
+        if( ++idle < POOL_SPINS )
+        {
+            cpu_relax();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( sleep_lock );
+        sleepers.fetch_add( 1, std::memory_order_seq_cst );
+        if( !work_visible() && !pool_stop.load( std::memory_order_acquire ) )
+            sleep_wake.wait_for( lock, std::chrono::milliseconds( 10 ) );
+        sleepers.fetch_sub( 1, std::memory_order_relaxed );
+        idle = 0;
+    }
+}
+
+static void pool_shutdown(void);
+
+static void pool_start(void)
+{
+    std::lock_guard<std::mutex> lock( pool_lock );
+    if( pool_size.load( std::memory_order_acquire ) ) return;
+
+    // the workers must be gone before exit destroys the locks they sleep on
+    static int registered = 0;
+    if( !registered ) registered = atexit( pool_shutdown ) == 0;
+
+    int size = pool_wanted > 0 ? pool_wanted : (int) std::thread::hardware_concurrency();
+    if( size < 1 ) size = 1;
+
+    pool_stop.store( 0 );
+    pool.resize( size );
+    for( int i = 0; i < size; i++ )
+    {
+        pool[i] = new pool_worker();
+        pool[i]->deque.top.store( 0 );
+        pool[i]->deque.bottom.store( 0 );
+        pool[i]->index = i;
+        pool[i]->seed = 2654435761u * ( i + 1 );
+    }
+    pool_size.store( size, std::memory_order_release );
+    for( int i = 0; i < size; i++ ) pool[i]->thread = std::thread( worker_loop, pool[i] );
+}
+
+static void pool_shutdown(void)
+{
+    std::lock_guard<std::mutex> lock( pool_lock );
+    if( !pool_size.load( std::memory_order_acquire ) ) return;
+    pool_stop.store( 1, std::memory_order_release );
+    {
+        std::lock_guard<std::mutex> wake( sleep_lock );
+        sleep_wake.notify_all();
+    }
+    for( size_t i = 0; i < pool.size(); i++ ) pool[i]->thread.join();
+    for( size_t i = 0; i < pool.size(); i++ ) delete pool[i];
+    pool.clear();
+    pool_size.store( 0, std::memory_order_release );
+}
+
+// a fork from outside the pool: queue the whole fork as one root job and wait
+static void pool_submit(const mm_task *task)
+{
+    if( !pool_size.load( std::memory_order_acquire ) ) pool_start();
+    std::atomic<int> pending( 1 );
+    pool_job job = { task, &pending, 1 };
+    {
+        std::lock_guard<std::mutex> lock( root_lock );
+        roots.push_back( &job );
+        root_count.fetch_add( 1, std::memory_order_release );
+    }
+    wake_sleepers();
+
+    std::unique_lock<std::mutex> lock( root_lock );
+    while( pending.load( std::memory_order_acquire ) > 0 ) root_done.wait( lock );
+}
+
+static void pool_invoke(const mm_task *tasks, int count);
+
+typedef struct {
+    const mm_task *tasks;
+    int count;
+} pool_fork;
+
+static void run_fork(const void *body)
+{
+    const pool_fork *fork = (const pool_fork *) body;
+    pool_invoke( fork->tasks, fork->count );
+}
+
+static void pool_invoke(const mm_task *tasks, int count)
+{
+    pool_worker *self = pool_self;
+    if( !self )
+    {
+        pool_fork fork = { tasks, count };
+        mm_task root = { run_fork, &fork };
+        pool_submit( &root );
+        return;
+    }
+
+    std::atomic<int> pending( count - 1 );
+    pool_job jobs[MM_MAX_TASKS];
+    int pushed = 0;
+    for( int i = 0; i < count - 1; i++ )
+    {
+        jobs[i].task = &tasks[i];
+        jobs[i].pending = &pending;
+        jobs[i].root = 0;
+        if( deque_push( &self->deque, &jobs[i] ) ) pushed = 1;
+        else run_job( &jobs[i] );   // deque full: run it here
+    }
+    if( pushed ) wake_sleepers();
+    tasks[count - 1].run( tasks[count - 1].body );
+
+    // the jobs of this fork that were not stolen are at the bottom of the deque
+    while( pending.load( std::memory_order_acquire ) > 0 )
+    {
+        pool_job *job = deque_pop( &self->deque );
+        if( !job ) job = find_work( self );
+        if( job ) run_job( job );
+        else cpu_relax();
+    }
+}
+
+typedef struct {
+    size_t begin, end, grain;
+    mm_range_fn run;
+    const void *body;
+} pool_range;
+
+// split the chunks of the range in halves down to single chunks
+static void run_range(const pool_range *r)
+{
+    size_t chunks = ( r->end - r->begin + r->grain - 1 ) / r->grain;
+    if( chunks <= 1 )
+    {
+        r->run( r->body, r->begin, r->end );
+        return;
+    }
+    size_t mid = r->begin + chunks / 2 * r->grain;
+    pool_range left = { r->begin, mid, r->grain, r->run, r->body };
+    pool_range right = { mid, r->end, r->grain, r->run, r->body };
+    mm_parallel_invoke( [&] { run_range( &right ); }, [&] { run_range( &left ); } );
+}
+
+static int pool_workers(void)
+{
+    if( !pool_size.load( std::memory_order_acquire ) ) pool_start();
+    return pool_size.load( std::memory_order_acquire );
+}
+
+static void pool_loop(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body)
+{
+    if( !grain ) grain = default_grain( end - begin, pool_workers() );
+    pool_range range = { begin, end, grain, run, body };
+    if( end - begin <= grain ) run( body, begin, end );
+    else run_range( &range );
+}
+
+static int pool_worker_id(void)
+{
+    return pool_self ? pool_self->index : 0;
+}
+
+static int pool_set_workers(int workers)
+{
+    if( workers > 0 && workers != pool_size.load( std::memory_order_acquire ) )
+    {
+        pool_shutdown();
+        pool_wanted = workers;
+    }
+    return pool_workers();
+}
+
+static const mm_backend threads_backend = {
+    "threads", pool_invoke, pool_loop, pool_workers, pool_worker_id, pool_set_workers
+};
+
+// the backends built in, the default first
+static const mm_backend *const backends[] = {
+#ifdef MM_USE_CILK
+    &cilk_backend,
+#endif
+#ifdef _OPENMP
+    &omp_backend,
+#endif
+    &threads_backend,
+    &serial_backend,
+    0
+};
+
+const mm_backend *mm_parallel_backend = backends[0];
+
+// $MM_BACKEND picks the backend before main runs
+static int backend_from_environment = mm_set_backend( getenv( "MM_BACKEND" ) );
+
+int mm_set_backend(const char *name)
+{
+    if( !name || !name[0] ) return -1;
+    for( int i = 0; backends[i]; i++ )
+    {
+        if( strcmp( backends[i]->name, name ) ) continue;
+        mm_parallel_backend = backends[i];
+        return 0;
+    }
+    return -1;
+}
+
+const char *mm_get_backend(void)
+{
+    return mm_parallel_backend->name;
+}
+
+const char *mm_backend_names(void)
+{
+    static char names[64];
+    if( !names[0] )
+        for( int i = 0; backends[i]; i++ )
+        {
+            if( i ) strcat( names, "," );
+            strcat( names, backends[i]->name );
+        }
+    return names;
+}
+
+int mm_get_workers(void)
+{
+    return mm_parallel_backend->workers();
+}
+
+int mm_set_workers(int workers)
+{
+    return mm_parallel_backend->set_workers( workers );
+}
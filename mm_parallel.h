@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_PARALLEL_H_
+#define _MM_PARALLEL_H_
+
+#include <stddef.h>
+
+/*
+ * The engine's parallel backends.  The recursion and the conversions fork
+ * and join only through mm_parallel_invoke and mm_parallel_for, which run
+ * on the backend picked with mm_set_backend:
+ *
+ *   cilk     the Cilk Plus runtime (built with MM_USE_CILK)
+ *   openmp   OpenMP tasks (built with -fopenmp)
+ *   threads  a pool of std::threads with lock-free work-stealing deques
+ *   serial   everything on the calling thread
+ */
+typedef struct {
+    void (*run)(const void *body);
+    const void *body;
+} mm_task;
+
+typedef void (*mm_range_fn)(const void *body, size_t lo, size_t hi);
+
+typedef struct {
+    const char *name;
+    // run tasks[0..count) in parallel, starting the last on the calling worker
+    void (*invoke)(const mm_task *tasks, int count);
+    // run [begin, end) in chunks of grain, or a backend default for 0
+    void (*loop)(size_t begin, size_t end, size_t grain, mm_range_fn run, const void *body);
+    int (*workers)(void);
+    int (*worker_id)(void);
+    int (*set_workers)(int workers);
+} mm_backend;
+
+extern const mm_backend *mm_parallel_backend;
+
+// most tasks one mm_parallel_invoke forks
+#define MM_MAX_TASKS 16
+
+template <typename F>
+static void mm_run_task(const void *body)
+{
+    ( *(const F *) body )();
+}
+
+template <typename F>
+static void mm_run_range(const void *body, size_t lo, size_t hi)
+{
+    ( *(const F *) body )( lo, hi );
+}
+
+template <typename F>
+static void mm_run_each(const void *body, size_t lo, size_t hi)
+{
+    for( size_t i = lo; i < hi; i++ ) ( *(const F *) body )( i );
+}
+
+/*
+ * Call every body() in parallel and return when all are done.  The last
+ * one starts on the calling worker, so it should be the one whose data
+ * that worker already holds.
+ */
+template <typename... F>
+static inline void mm_parallel_invoke(const F &... bodies)
+{
+    static_assert( sizeof...(F) <= MM_MAX_TASKS, "too many tasks for one fork" );
+    mm_task tasks[] = { { mm_run_task<F>, &bodies }... };
+    mm_parallel_backend->invoke( tasks, (int) sizeof...(F) );
+}
+
+// body(i) for every i in [begin, end), like cilk_for
+template <typename F>
+static inline void mm_parallel_for(size_t begin, size_t end, const F &body)
+{
+    if( begin < end ) mm_parallel_backend->loop( begin, end, 0, mm_run_each<F>, &body );
+}
+
+// body(lo, hi) over [begin, end) cut into chunks of at most grain
+template <typename F>
+static inline void mm_parallel_for_range(size_t begin, size_t end, size_t grain, const F &body)
+{
+    if( begin < end ) mm_parallel_backend->loop( begin, end, grain, mm_run_range<F>, &body );
+}
+
+// number of workers of the backend and the one running the caller, in [0, workers)
+static inline int mm_parallel_workers(void)
+{
+    return mm_parallel_backend->workers();
+}
+
+static inline int mm_parallel_worker_id(void)
+{
+    return mm_parallel_backend->worker_id();
+}
+
+#endif  // _MM_PARALLEL_H_
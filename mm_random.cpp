@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_dac.h"
+#include "mm_parallel.h"
+
+// regions of at most this many tiles are generated without spawning
+#define RANDOM_GRAIN_TILES 16
+
+/*
+ * Philox-4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3"): ten rounds of multiplies and xors scramble a 128-bit counter
+ * under a 64-bit key.  The counter is the element's (row, column), so every
+ * element is computed on its own and the matrix is the same whatever order
+ * or worker fills it.
+ */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static inline void philox( uint64_t seed, uint32_t row, uint32_t col, uint32_t out[4] )
+{
+    uint32_t key0 = (uint32_t) seed, key1 = (uint32_t)( seed >> 32 );
+    uint32_t c0 = row, c1 = col, c2 = 0, c3 = 0;
+
+    for( int round = 0; round < 10; round++ )
+    {
+        uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+        c0 = (uint32_t)( p1 >> 32 ) ^ c1 ^ key0;
+        c1 = (uint32_t) p1;
+        c2 = (uint32_t)( p0 >> 32 ) ^ c3 ^ key1;
+        c3 = (uint32_t) p0;
+        key0 += PHILOX_W0;
+        key1 += PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// integers in [0, 32767] like rand(); int8 covers its full signed range
+template <typename T> static inline T random_elem( const uint32_t x[4] ) { return T( x[0] >> 17 ); }
+template <> inline int8_t random_elem<int8_t>( const uint32_t x[4] ) { return (int8_t)( (int)( x[0] >> 24 ) - 128 ); }
+template <> inline std::complex<float> random_elem< std::complex<float> >( const uint32_t x[4] ) {
+    return std::complex<float>( (float)( x[0] >> 17 ), (float)( x[1] >> 17 ) );
+}
+template <> inline std::complex<double> random_elem< std::complex<double> >( const uint32_t x[4] ) {
+    return std::complex<double>( (double)( x[0] >> 17 ), (double)( x[1] >> 17 ) );
+}
+
+template <typename T>
+static inline T random_at( uint64_t seed, int row, int col )
+{
+    uint32_t x[4];
+    philox( seed, (uint32_t) row, (uint32_t) col, x );
+    return random_elem<T>( x );
+}
+
+template <typename T>
+void mm_random(uint64_t seed, int rows, int cols, T *M, int ld)
+{
+    mm_parallel_for( 0, rows, [&]( int i ) {
+        T *row = M + (size_t) i * ld;
+        for( int j = 0; j < cols; j++ )
+            row[j] = random_at<T>( seed, i, j );
+    } );
+}
+
+/*
+ * Everything about a Morton generation that stays fixed during the walk;
+ * b_style selects B tiles (column major, quadrants down the columns first).
+ */
+typedef struct {
+    uint64_t seed;
+    int rows;
+    int cols;
+    int bs;
+    int b_style;
+} random_args;
+
+template <typename T>
+static void random_tile( const random_args *args, T *tile, int row_index, int col_index )
+{
+    const int bs = args->bs;
+    int row_end = args->rows - row_index < bs ? args->rows - row_index : bs;
+    int col_end = args->cols - col_index < bs ? args->cols - col_index : bs;
+
+    if( row_end < bs || col_end < bs )
+    {
+        // edge tile; the part outside the matrix is zero padding
+        memset( (void *) tile, 0, (size_t) bs * bs * sizeof(T) );
+    }
+    for( int r = 0; r < row_end; r++ )
+        for( int c = 0; c < col_end; c++ )
+            tile[args->b_style ? c * bs + r : r * bs + c] = random_at<T>( args->seed, row_index + r, col_index + c );
+}
+
+// the quadrant walk of convert_morton in mm_morton.cpp
+template <typename T>
+static void random_morton( const random_args *args, T *z, int tile_rows, int tile_cols, int row_index, int col_index )
+{
+    if( tile_rows == 1 && tile_cols == 1 )
+    {
+        random_tile( args, z, row_index, col_index );
+        return;
+    }
+
+    const int bs = args->bs;
+    const size_t tile_size = (size_t) bs * bs;
+    int tr0 = ( tile_rows + 1 ) >> 1, tr1 = tile_rows - tr0;
+    int tc0 = ( tile_cols + 1 ) >> 1, tc1 = tile_cols - tc0;
+    T *top_left = z;
+    T *top_right, *bottom_left, *bottom_right;
+    if( args->b_style )
+    {
+        bottom_left  = z + (size_t) tr0 * tc0 * tile_size;
+        top_right    = z + (size_t) tile_rows * tc0 * tile_size;
+        bottom_right = top_right + (size_t) tr0 * tc1 * tile_size;
+    }
+    else
+    {
+        top_right    = z + (size_t) tr0 * tc0 * tile_size;
+        bottom_left  = z + (size_t) tr0 * tile_cols * tile_size;
+        bottom_right = bottom_left + (size_t) tr1 * tc0 * tile_size;
+    }
+    int row_half = row_index + tr0 * bs;
+    int col_half = col_index + tc0 * bs;
+
+    if( (size_t) tile_rows * tile_cols <= RANDOM_GRAIN_TILES )
+    {
+        random_morton( args, top_left, tr0, tc0, row_index, col_index );
+        if( tc1 ) random_morton( args, top_right, tr0, tc1, row_index, col_half );
+        if( tr1 ) random_morton( args, bottom_left, tr1, tc0, row_half, col_index );
+        if( tr1 && tc1 ) random_morton( args, bottom_right, tr1, tc1, row_half, col_half );
+        return;
+    }
+
+    mm_parallel_invoke(
+        [&] { if( tc1 ) random_morton( args, top_right, tr0, tc1, row_index, col_half ); },
+        [&] { if( tr1 ) random_morton( args, bottom_left, tr1, tc0, row_half, col_index ); },
+        [&] { if( tr1 && tc1 ) random_morton( args, bottom_right, tr1, tc1, row_half, col_half ); },
+        [&] { random_morton( args, top_left, tr0, tc0, row_index, col_index ); } );
+}
+
+template <typename T>
+void mm_random_morton(char side, uint64_t seed, int rows, int cols, T *morton)
+{
+    if( rows <= 0 || cols <= 0 ) return;
+
+    mm_options options;
+    mm_get_options( &options );
+    int bs = options.leaf_size > 0 ? options.leaf_size : MM_DEFAULT_LEAF_SIZE;
+    random_args args = { seed, rows, cols, bs, side == 'B' || side == 'b' };
+    random_morton( &args, morton, ( rows + bs - 1 ) / bs, ( cols + bs - 1 ) / bs, 0, 0 );
+}
+
+#define MM_INSTANTIATE_RANDOM(T) \
+    template void mm_random<T>(uint64_t, int, int, T *, int); \
+    template void mm_random_morton<T>(char, uint64_t, int, int, T *);
+
+MM_INSTANTIATE_RANDOM(float)
+MM_INSTANTIATE_RANDOM(double)
+MM_INSTANTIATE_RANDOM(int8_t)
+MM_INSTANTIATE_RANDOM(std::complex<float>)
+MM_INSTANTIATE_RANDOM(std::complex<double>)
@@ -0,0 +1,661 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <atomic>
+#include <complex>
+
+#include "ktiming.h"
+#include "mm_dac.h"
+#include "mm_server.h"
+
+#define MAX_MAPPINGS 8
+#define CACHE_ENTRIES 16
+#define WARMUP_SIZE 256
+
+/*
+ * Service latencies, in nanoseconds, of every job the server has run (or
+ * round trips the client has seen), grown as needed under the lock.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t *nanos;
+    size_t count;
+    size_t capacity;
+} latency_log;
+
+static void log_latency(latency_log *log, uint64_t nanos)
+{
+    pthread_mutex_lock( &log->lock );
+    if( log->count == log->capacity )
+    {
+        size_t capacity = log->capacity ? 2 * log->capacity : 1024;
+        uint64_t *grown = (uint64_t *) realloc( log->nanos, capacity * sizeof(uint64_t) );
+        if( grown )
+        {
+            log->nanos = grown;
+            log->capacity = capacity;
+        }
+    }
+    if( log->count < log->capacity ) log->nanos[log->count++] = nanos;
+    pthread_mutex_unlock( &log->lock );
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// p50, p90, p99, p99.9 and max of the log so far; returns the job count
+static uint64_t percentiles(latency_log *log, uint64_t *stats)
+{
+    static const double ranks[NUM_STATS] = { 0.50, 0.90, 0.99, 0.999, 1.0 };
+    memset( stats, 0, NUM_STATS * sizeof(uint64_t) );
+
+    pthread_mutex_lock( &log->lock );
+    size_t count = log->count;
+    uint64_t *sorted = count ? (uint64_t *) malloc( count * sizeof(uint64_t) ) : 0;
+    if( sorted ) memcpy( sorted, log->nanos, count * sizeof(uint64_t) );
+    pthread_mutex_unlock( &log->lock );
+    if( !sorted ) return 0;
+
+    qsort( sorted, count, sizeof(uint64_t), compare_uint64 );
+    for( int s = 0; s < NUM_STATS; s++ )
+    {
+        size_t rank = (size_t)( ranks[s] * count + 0.5 );
+        stats[s] = sorted[rank > 0 ? ( rank < count ? rank : count ) - 1 : 0];
+    }
+    free( sorted );
+    return count;
+}
+
+static void print_percentiles(const char *who, uint64_t jobs, const uint64_t *stats)
+{
+    printf( "%s latency over %llu jobs in microseconds: p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+            who, (unsigned long long) jobs, stats[STAT_P50] * 1.0e-3, stats[STAT_P90] * 1.0e-3,
+            stats[STAT_P99] * 1.0e-3, stats[STAT_P999] * 1.0e-3, stats[STAT_MAX] * 1.0e-3 );
+}
+
+static int read_full(int fd, void *buffer, size_t bytes)
+{
+    char *p = (char *) buffer;
+    while( bytes > 0 )
+    {
+        ssize_t got = read( fd, p, bytes );
+        if( got < 0 && errno == EINTR ) continue;
+        if( got <= 0 ) return -1;
+        p += got;
+        bytes -= got;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buffer, size_t bytes)
+{
+    const char *p = (const char *) buffer;
+    while( bytes > 0 )
+    {
+        ssize_t put = write( fd, p, bytes );
+        if( put < 0 && errno == EINTR ) continue;
+        if( put <= 0 ) return -1;
+        p += put;
+        bytes -= put;
+    }
+    return 0;
+}
+
+/*
+ * Packed B operands that clients asked to keep, keyed by their b_key along
+ * with everything the packed layout depends on.  Entries in use by a job
+ * hold a reference; when the cache is full the least recently used entry
+ * without one is dropped.
+ */
+typedef struct {
+    uint64_t key;
+    uint32_t dtype;
+    int k, n;
+    char transb;
+    int leaf;
+    mm_packed *packed;
+    int refs;
+    uint64_t last_use;
+} cache_entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry cache[CACHE_ENTRIES];
+static uint64_t cache_clock;
+
+static int cache_match(const cache_entry *e, const server_request *r, int leaf)
+{
+    return e->packed && e->key == r->b_key && e->dtype == r->dtype && e->k == r->k && e->n == r->n &&
+           e->transb == r->transb && e->leaf == leaf;
+}
+
+static mm_packed *cache_lookup(const server_request *r, int leaf)
+{
+    mm_packed *packed = 0;
+    pthread_mutex_lock( &cache_lock );
+    for( int i = 0; i < CACHE_ENTRIES && !packed; i++ )
+    {
+        if( !cache_match( &cache[i], r, leaf ) ) continue;
+        cache[i].refs++;
+        cache[i].last_use = ++cache_clock;
+        packed = cache[i].packed;
+    }
+    pthread_mutex_unlock( &cache_lock );
+    return packed;
+}
+
+/*
+ * Add a freshly packed B, holding one reference for the caller.  Returns
+ * the handle the caller should use: an equal entry another connection
+ * inserted in the meantime wins over packed, which is then freed.  When
+ * every entry is in use packed is returned uncached and the caller frees
+ * it after its job (cache_release reports that with 0).
+ */
+static mm_packed *cache_insert(const server_request *r, int leaf, mm_packed *packed)
+{
+    mm_packed *evicted = 0, *result = packed;
+    int victim = -1;
+    pthread_mutex_lock( &cache_lock );
+    for( int i = 0; i < CACHE_ENTRIES; i++ )
+    {
+        if( cache_match( &cache[i], r, leaf ) )
+        {
+            cache[i].refs++;
+            cache[i].last_use = ++cache_clock;
+            result = cache[i].packed;
+            victim = -2;
+            break;
+        }
+        if( cache[i].refs == 0 && ( victim < 0 || !cache[i].packed ||
+                                    ( cache[victim].packed && cache[i].last_use < cache[victim].last_use ) ) )
+            victim = i;
+    }
+    if( victim >= 0 )
+    {
+        cache_entry *e = &cache[victim];
+        evicted = e->packed;
+        e->key = r->b_key;
+        e->dtype = r->dtype;
+        e->k = r->k;
+        e->n = r->n;
+        e->transb = r->transb;
+        e->leaf = leaf;
+        e->packed = packed;
+        e->refs = 1;
+        e->last_use = ++cache_clock;
+    }
+    pthread_mutex_unlock( &cache_lock );
+
+    mm_packed_free( evicted );
+    if( result != packed ) mm_packed_free( packed );
+    return result;
+}
+
+// drop the reference of a job; returns 0 if packed is not in the cache
+static int cache_release(mm_packed *packed)
+{
+    int found = 0;
+    pthread_mutex_lock( &cache_lock );
+    for( int i = 0; i < CACHE_ENTRIES && !found; i++ )
+    {
+        if( cache[i].packed != packed ) continue;
+        cache[i].refs--;
+        found = 1;
+    }
+    pthread_mutex_unlock( &cache_lock );
+    return found;
+}
+
+static void cache_clear(void)
+{
+    for( int i = 0; i < CACHE_ENTRIES; i++ )
+    {
+        mm_packed_free( cache[i].packed );
+        memset( &cache[i], 0, sizeof(cache_entry) );
+    }
+}
+
+template <typename U> static U scalar(const double *v) { return U( v[0] ); }
+template <> std::complex<float> scalar(const double *v) { return std::complex<float>( v[0], v[1] ); }
+template <> std::complex<double> scalar(const double *v) { return std::complex<double>( v[0], v[1] ); }
+
+// whether a rows x cols matrix with leading dimension ld fits at offset
+static int fits(uint64_t offset, int rows, int cols, int ld, size_t elem, size_t size)
+{
+    if( ld < cols || offset % elem ) return 0;
+    uint64_t extent = ( (uint64_t)( rows - 1 ) * ld + cols ) * elem;
+    return offset <= size && extent <= size - offset;
+}
+
+template <typename T>
+static int serve_gemm(const server_request *r, char *base, size_t size)
+{
+    typedef typename mm_types<T>::acc acc_t;
+    int a_rows = r->transa == 'N' ? r->m : r->k, a_cols = r->transa == 'N' ? r->k : r->m;
+    int b_rows = r->transb == 'N' ? r->k : r->n, b_cols = r->transb == 'N' ? r->n : r->k;
+    if( !fits( r->a_offset, a_rows, a_cols, r->lda, sizeof(T), size ) ||
+        !fits( r->b_offset, b_rows, b_cols, r->ldb, sizeof(T), size ) ||
+        !fits( r->c_offset, r->m, r->n, r->ldc, sizeof(acc_t), size ) )
+        return -1;
+
+    const T *A = (const T *)( base + r->a_offset );
+    const T *B = (const T *)( base + r->b_offset );
+    acc_t *C = (acc_t *)( base + r->c_offset );
+    acc_t alpha = scalar<acc_t>( r->alpha ), beta = scalar<acc_t>( r->beta );
+    if( !r->b_key )
+        return mm_gemm<T>( r->transa, r->transb, r->m, r->n, r->k, alpha, A, r->lda, B, r->ldb, beta, C, r->ldc );
+
+    // a cached B is packed with the leaf size of the problem it was first used for
+    mm_options options;
+    mm_get_options( &options );
+    int leaf = options.leaf_size;
+    mm_packed *packed = cache_lookup( r, leaf );
+    if( !packed )
+    {
+        packed = mm_pack<T>( 'B', r->transb, r->k, r->n, B, r->ldb );
+        if( !packed ) return -1;
+        packed = cache_insert( r, leaf, packed );
+    }
+    int result = mm_gemm_packed_b<T>( r->transa, r->m, r->n, r->k, alpha, A, r->lda, packed, beta, C, r->ldc );
+    if( !cache_release( packed ) ) mm_packed_free( packed );
+    return result;
+}
+
+static int serve_job(const server_request *r, char *base, size_t size)
+{
+    if( r->m <= 0 || r->n <= 0 || r->k <= 0 ||
+        ( r->transa != 'N' && r->transa != 'T' ) || ( r->transb != 'N' && r->transb != 'T' ) )
+        return -1;
+    switch( r->dtype )
+    {
+        case MM_FLOAT32: return serve_gemm<float>( r, base, size );
+        case MM_FLOAT64: return serve_gemm<double>( r, base, size );
+        case MM_INT8: return serve_gemm<int8_t>( r, base, size );
+        case MM_COMPLEX64: return serve_gemm< std::complex<float> >( r, base, size );
+        case MM_COMPLEX128: return serve_gemm< std::complex<double> >( r, base, size );
+    }
+    return -1;
+}
+
+typedef struct {
+    char name[64];
+    char *base;
+    size_t size;
+} mapping;
+
+// shared memory objects a connection has named, mapped on first use
+typedef struct {
+    int fd;
+    mapping maps[MAX_MAPPINGS];
+    int num_maps;
+} connection;
+
+static const mapping *find_mapping(connection *c, const char *name)
+{
+    for( int i = 0; i < c->num_maps; i++ )
+        if( !strcmp( c->maps[i].name, name ) ) return &c->maps[i];
+    if( c->num_maps == MAX_MAPPINGS || name[0] != '/' ) return 0;
+
+    int fd = shm_open( name, O_RDWR, 0 );
+    if( fd < 0 ) return 0;
+    struct stat st;
+    void *base = MAP_FAILED;
+    if( fstat( fd, &st ) == 0 && st.st_size > 0 )
+        base = mmap( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ) return 0;
+
+    mapping *m = &c->maps[c->num_maps++];
+    strcpy( m->name, name );
+    m->base = (char *) base;
+    m->size = st.st_size;
+    return m;
+}
+
+static latency_log server_log = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+static pthread_mutex_t active_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t active_done = PTHREAD_COND_INITIALIZER;
+static int active;
+// set by the connection thread that receives SERVER_SHUTDOWN
+static std::atomic<int> stopping( 0 );
+static int listen_fd = -1;
+
+static void *serve_connection(void *arg)
+{
+    connection *c = (connection *) arg;
+    server_request request;
+    server_reply reply;
+
+    while( read_full( c->fd, &request, sizeof(request) ) == 0 && request.magic == SERVER_MAGIC )
+    {
+        clockmark_t begin = ktiming_getmark();
+        memset( &reply, 0, sizeof(reply) );
+        if( request.op == SERVER_GEMM )
+        {
+            request.shm_name[sizeof(request.shm_name) - 1] = 0;
+            const mapping *m = find_mapping( c, request.shm_name );
+            reply.status = m ? serve_job( &request, m->base, m->size ) : -1;
+            clockmark_t end = ktiming_getmark();
+            reply.service_nsec = ktiming_diff_usec( &begin, &end );
+            if( reply.status == 0 ) log_latency( &server_log, reply.service_nsec );
+        }
+        else if( request.op == SERVER_STATS ) reply.jobs = percentiles( &server_log, reply.stats );
+        else if( request.op == SERVER_SHUTDOWN )
+        {
+            stopping.store( 1 );
+            shutdown( listen_fd, SHUT_RDWR );
+        }
+        else reply.status = -1;
+        if( write_full( c->fd, &reply, sizeof(reply) ) ) break;
+    }
+
+    for( int i = 0; i < c->num_maps; i++ ) munmap( c->maps[i].base, c->maps[i].size );
+    close( c->fd );
+    free( c );
+
+    pthread_mutex_lock( &active_lock );
+    if( --active == 0 ) pthread_cond_signal( &active_done );
+    pthread_mutex_unlock( &active_lock );
+    return 0;
+}
+
+static int unix_address(const char *path, struct sockaddr_un *address)
+{
+    memset( address, 0, sizeof(*address) );
+    address->sun_family = AF_UNIX;
+    if( strlen( path ) >= sizeof(address->sun_path) ) return -1;
+    strcpy( address->sun_path, path );
+    return 0;
+}
+
+/*
+ * Serve jobs on a Unix socket at socket_path until a client sends
+ * SERVER_SHUTDOWN.  A small multiply first starts the workers and fills the
+ * arena so the first client does not pay for them.
+ */
+int run_server(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if( unix_address( socket_path, &address ) )
+    {
+        fprintf( stderr, "Socket path %s is too long\n", socket_path );
+        return 1;
+    }
+    signal( SIGPIPE, SIG_IGN );
+
+    double *warm = (double *) malloc( 3 * WARMUP_SIZE * WARMUP_SIZE * sizeof(double) );
+    if( warm )
+    {
+        double *A = warm, *B = A + WARMUP_SIZE * WARMUP_SIZE, *C = B + WARMUP_SIZE * WARMUP_SIZE;
+        mm_random( 0, WARMUP_SIZE, WARMUP_SIZE, A, WARMUP_SIZE );
+        mm_random( 1, WARMUP_SIZE, WARMUP_SIZE, B, WARMUP_SIZE );
+        mm_gemm<double>( 'N', 'N', WARMUP_SIZE, WARMUP_SIZE, WARMUP_SIZE, 1.0, A, WARMUP_SIZE, B, WARMUP_SIZE,
+                         0.0, C, WARMUP_SIZE );
+        free( warm );
+    }
+
+    listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    unlink( socket_path );
+    if( listen_fd < 0 || bind( listen_fd, (struct sockaddr *) &address, sizeof(address) ) ||
+        listen( listen_fd, 64 ) )
+    {
+        perror( socket_path );
+        if( listen_fd >= 0 ) close( listen_fd );
+        return 1;
+    }
+    printf( "Serving on %s with %d workers\n", socket_path, mm_get_workers() );
+    fflush( stdout );
+
+    while( !stopping.load() )
+    {
+        int fd = accept( listen_fd, 0, 0 );
+        if( fd < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED ) continue;
+            break;
+        }
+        connection *c = (connection *) calloc( 1, sizeof(connection) );
+        pthread_t thread;
+        if( c ) c->fd = fd;
+        pthread_mutex_lock( &active_lock );
+        active++;
+        pthread_mutex_unlock( &active_lock );
+        if( !c || pthread_create( &thread, 0, serve_connection, c ) )
+        {
+            close( fd );
+            free( c );
+            pthread_mutex_lock( &active_lock );
+            active--;
+            pthread_mutex_unlock( &active_lock );
+            continue;
+        }
+        pthread_detach( thread );
+    }
+
+    // the connections still open finish their jobs first
+    pthread_mutex_lock( &active_lock );
+    while( active > 0 ) pthread_cond_wait( &active_done, &active_lock );
+    pthread_mutex_unlock( &active_lock );
+    close( listen_fd );
+    unlink( socket_path );
+    cache_clear();
+
+    uint64_t stats[NUM_STATS];
+    uint64_t jobs = percentiles( &server_log, stats );
+    print_percentiles( "Server", jobs, stats );
+    return 0;
+}
+
+static int connect_server(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if( unix_address( socket_path, &address ) ) return -1;
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd >= 0 && connect( fd, (struct sockaddr *) &address, sizeof(address) ) )
+    {
+        close( fd );
+        fd = -1;
+    }
+    return fd;
+}
+
+static int send_request(int fd, const server_request *request, server_reply *reply)
+{
+    if( write_full( fd, request, sizeof(*request) ) || read_full( fd, reply, sizeof(*reply) ) ) return -1;
+    return reply->status;
+}
+
+typedef struct {
+    const client_options *options;
+    int index;
+    latency_log *log;
+    int failed;
+} client_thread;
+
+static size_t round_up(size_t bytes)
+{
+    return ( bytes + 63 ) & ~(size_t) 63;
+}
+
+/*
+ * One client: A, B and C live in a shared memory object of its own, A and
+ * B filled from the seed and the client index, and every job computes
+ * C = A B over them with the same B (kept packed on the server with
+ * cache_b).  Round trips go into the shared client log.
+ */
+template <typename T>
+static void *client(void *arg)
+{
+    typedef typename mm_types<T>::acc acc_t;
+    client_thread *t = (client_thread *) arg;
+    const client_options *o = t->options;
+    int m = o->m, n = o->n, k = o->k;
+    size_t a_bytes = round_up( (size_t)m * k * sizeof(T) ), b_bytes = round_up( (size_t)k * n * sizeof(T) );
+    size_t size = a_bytes + b_bytes + (size_t)m * n * sizeof(acc_t);
+
+    server_request request;
+    memset( &request, 0, sizeof(request) );
+    snprintf( request.shm_name, sizeof(request.shm_name), "/mm_dac.%d.%d", (int) getpid(), t->index );
+
+    t->failed = 1;
+    int shm = shm_open( request.shm_name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if( shm < 0 )
+    {
+        perror( request.shm_name );
+        return 0;
+    }
+    char *base = (char *) MAP_FAILED;
+    if( ftruncate( shm, size ) == 0 ) base = (char *) mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0 );
+    close( shm );
+    int fd = base == MAP_FAILED ? -1 : connect_server( o->socket_path );
+    if( fd < 0 ) fprintf( stderr, "Client %d could not %s\n", t->index, base == MAP_FAILED ? "map its operands" :
+                                                                          "connect to the server" );
+    else
+    {
+        T *A = (T *) base, *B = (T *)( base + a_bytes );
+        acc_t *C = (acc_t *)( base + a_bytes + b_bytes );
+        mm_random( (uint64_t) o->seed + 2 * t->index, m, k, A, k );
+        mm_random( (uint64_t) o->seed + 2 * t->index + 1, k, n, B, n );
+
+        request.magic = SERVER_MAGIC;
+        request.op = SERVER_GEMM;
+        request.dtype = mm_types<T>::dtype;
+        request.transa = request.transb = 'N';
+        request.m = m;
+        request.n = n;
+        request.k = k;
+        request.lda = k;
+        request.ldb = n;
+        request.ldc = n;
+        request.alpha[0] = 1.0;
+        request.a_offset = 0;
+        request.b_offset = a_bytes;
+        request.c_offset = a_bytes + b_bytes;
+        request.b_key = o->cache_b ? ( (uint64_t) getpid() << 16 ) + t->index + 1 : 0;
+
+        server_reply reply;
+        int job;
+        for( job = 0; job < o->jobs; job++ )
+        {
+            clockmark_t begin = ktiming_getmark();
+            if( send_request( fd, &request, &reply ) ) break;
+            clockmark_t end = ktiming_getmark();
+            log_latency( t->log, ktiming_diff_usec( &begin, &end ) );
+        }
+        if( job < o->jobs ) fprintf( stderr, "Client %d: job %d failed\n", t->index, job );
+        else if( o->verify && mm_verify( MM_VERIFY_AUTO, m, n, k, A, k, B, n, C, n, 0, -1.0, -1.0 ) )
+            fprintf( stderr, "Client %d: result is wrong\n", t->index );
+        else t->failed = 0;
+        close( fd );
+    }
+    if( base != MAP_FAILED ) munmap( base, size );
+    shm_unlink( request.shm_name );
+    return 0;
+}
+
+template <typename T>
+static int run_clients(const client_options *options)
+{
+    int clients = options->clients > 0 ? options->clients : 1;
+    client_thread *threads = (client_thread *) calloc( clients, sizeof(client_thread) );
+    pthread_t *ids = (pthread_t *) calloc( clients, sizeof(pthread_t) );
+    latency_log log = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+    int failed = !threads || !ids, started = 0;
+
+    clockmark_t begin = ktiming_getmark();
+    for( ; started < clients && !failed; started++ )
+    {
+        threads[started].options = options;
+        threads[started].index = started;
+        threads[started].log = &log;
+        if( pthread_create( &ids[started], 0, client<T>, &threads[started] ) )
+        {
+            failed = 1;
+            break;
+        }
+    }
+    for( int i = 0; i < started; i++ )
+    {
+        pthread_join( ids[i], 0 );
+        failed |= threads[i].failed;
+    }
+    clockmark_t end = ktiming_getmark();
+
+    uint64_t stats[NUM_STATS];
+    uint64_t jobs = percentiles( &log, stats );
+    double seconds = ktiming_diff_sec( &begin, &end );
+    printf( "%llu jobs in %f seconds, %.1f jobs/s\n", (unsigned long long) jobs, seconds,
+            seconds > 0.0 ? jobs / seconds : 0.0 );
+    print_percentiles( "Client round-trip", jobs, stats );
+    if( options->verify && !failed ) printf( "All results are correct\n" );
+
+    free( threads );
+    free( ids );
+    free( log.nanos );
+    return failed;
+}
+
+/*
+ * Drive a server with the given load, then print its own latencies and
+ * shut it down if asked to.
+ */
+int run_client(const client_options *options)
+{
+    int result;
+    if( !strcmp( options->type, "double" ) ) result = run_clients<double>( options );
+    else if( !strcmp( options->type, "float" ) ) result = run_clients<float>( options );
+    else if( !strcmp( options->type, "int8" ) ) result = run_clients<int8_t>( options );
+    else if( !strcmp( options->type, "complex64" ) ) result = run_clients< std::complex<float> >( options );
+    else if( !strcmp( options->type, "complex128" ) ) result = run_clients< std::complex<double> >( options );
+    else return -1;
+
+    int fd = connect_server( options->socket_path );
+    if( fd < 0 )
+    {
+        fprintf( stderr, "Could not connect to %s\n", options->socket_path );
+        return 1;
+    }
+    server_request request;
+    server_reply reply;
+    memset( &request, 0, sizeof(request) );
+    request.magic = SERVER_MAGIC;
+    request.op = SERVER_STATS;
+    if( send_request( fd, &request, &reply ) == 0 ) print_percentiles( "Server service", reply.jobs, reply.stats );
+    request.op = SERVER_SHUTDOWN;
+    if( options->stop && send_request( fd, &request, &reply ) ) result = 1;
+    close( fd );
+    return result;
+}
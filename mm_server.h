@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_SERVER_H_
+#define _MM_SERVER_H_
+
+#include <stdint.h>
+
+/*
+ * Server mode of mm_dac.  One long-running process keeps the workers of the
+ * parallel backend, the engine's buffer arena and packed B operands warm, and runs
+ * multiply jobs sent by clients over a local Unix socket.  The operands
+ * stay in a POSIX shared memory object that the client created: a request
+ * names the object and gives byte offsets into it, and the server maps it
+ * once per connection and multiplies in place.  Every connection has its
+ * own thread, and all of them submit to the backend's one scheduler, so
+ * jobs from different clients run concurrently.
+ *
+ * A request is answered by one reply; SERVER_STATS replies carry the
+ * server's job latency percentiles so far.
+ */
+#define SERVER_MAGIC 0x4d4d4453u
+
+enum server_op {
+    SERVER_GEMM,
+    SERVER_STATS,
+    SERVER_SHUTDOWN
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t dtype;         // mm_dtype of A and B
+    char transa;
+    char transb;
+    char reserved[2];
+    int32_t m, n, k;
+    int32_t lda, ldb, ldc;
+    double alpha[2];        // real and imaginary part
+    double beta[2];
+    uint64_t a_offset;      // bytes into the shared memory object
+    uint64_t b_offset;
+    uint64_t c_offset;
+    uint64_t b_key;         // nonzero: B is reused, keep it packed under this key
+    char shm_name[64];
+} server_request;
+
+// latency percentiles in a SERVER_STATS reply
+enum { STAT_P50, STAT_P90, STAT_P99, STAT_P999, STAT_MAX, NUM_STATS };
+
+typedef struct {
+    int32_t status;         // 0, or -1 when the job failed
+    uint32_t reserved;
+    uint64_t service_nsec;  // time the server spent on the job
+    uint64_t jobs;          // SERVER_STATS: jobs served so far
+    uint64_t stats[NUM_STATS];
+} server_reply;
+
+/*
+ * Load generator: clients connections at once, each sending jobs m x k by
+ * k x n multiplies of type on operands in its own shared memory object.
+ * cache_b keeps every client's B packed on the server; verify checks the
+ * last result of each client; stop shuts the server down afterwards.
+ */
+typedef struct {
+    const char *socket_path;
+    const char *type;
+    int m, n, k;
+    int jobs;
+    int clients;
+    int cache_b;
+    int verify;
+    int stop;
+    int seed;
+} client_options;
+
+int run_server(const char *socket_path);
+int run_client(const client_options *options);
+
+#endif  // _MM_SERVER_H_
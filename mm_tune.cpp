@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm_dac.h"
+
+// leaf widths tried by mm_autotune
+static const int leaf_candidates[] = { 8, 16, 32, 64, 128, 0 };
+
+#define MAX_TUNE_ENTRIES 256
+#define TUNE_REPS 3
+
+/*
+ * One tuned leaf size.  Problems are grouped by size class, the floor of
+ * log2 of their largest dimension, so an entry covers [2^c, 2^(c+1)).
+ */
+typedef struct {
+    mm_dtype dtype;
+    int size_class;
+    int workers;
+    int leaf_size;
+} tune_entry;
+
+static tune_entry tune_table[MAX_TUNE_ENTRIES];
+static int tune_count = 0;
+
+static const char *dtype_names[] = { "float", "double", "int8", "int32", "complex64", "complex128" };
+
+const char *mm_dtype_name(mm_dtype dtype)
+{
+    return (unsigned) dtype < sizeof(dtype_names) / sizeof(dtype_names[0]) ? dtype_names[dtype] : "unknown";
+}
+
+static int size_class(int n)
+{
+    int c = 0;
+    while( c < 30 && ( 2 << c ) <= n ) c++;
+    return c;
+}
+
+static tune_entry *find_entry(mm_dtype dtype, int cls, int workers)
+{
+    for( int i = 0; i < tune_count; i++ )
+        if( tune_table[i].dtype == dtype && tune_table[i].size_class == cls && tune_table[i].workers == workers )
+            return &tune_table[i];
+    return 0;
+}
+
+static void set_entry(mm_dtype dtype, int cls, int workers, int leaf_size)
+{
+    tune_entry *entry = find_entry( dtype, cls, workers );
+    if( !entry )
+    {
+        if( tune_count == MAX_TUNE_ENTRIES ) return;
+        entry = &tune_table[tune_count++];
+        entry->dtype = dtype;
+        entry->size_class = cls;
+        entry->workers = workers;
+    }
+    entry->leaf_size = leaf_size;
+}
+
+static double padded(int n, int leaf)
+{
+    return (double)( ( n + leaf - 1 ) / leaf ) * leaf;
+}
+
+/*
+ * Leaf size for a problem nothing close has been tuned for: 64, or 32 for
+ * the complex types whose tiles are two to four times larger, halved while
+ * padding m, n and k to whole tiles would more than double the work.
+ */
+static int default_leaf_size(mm_dtype dtype, int m, int n, int k)
+{
+    int leaf = dtype == MM_COMPLEX64 || dtype == MM_COMPLEX128 ? 32 : 64;
+    double work = (double) m * n * k;
+    while( leaf > leaf_candidates[0] && padded( m, leaf ) * padded( n, leaf ) * padded( k, leaf ) > 2 * work )
+        leaf /= 2;
+    return leaf;
+}
+
+int mm_tuned_leaf_size(mm_dtype dtype, int m, int n, int k)
+{
+    int largest = m > n ? m : n;
+    if( k > largest ) largest = k;
+    int cls = size_class( largest );
+    int workers = mm_get_workers();
+
+    // exact match, else the nearest tuned size class on this worker count
+    const tune_entry *best = 0;
+    int best_dist = 0;
+    for( int i = 0; i < tune_count; i++ )
+    {
+        const tune_entry *entry = &tune_table[i];
+        if( entry->dtype != dtype || entry->workers != workers ) continue;
+        int dist = entry->size_class > cls ? entry->size_class - cls : cls - entry->size_class;
+        if( !best || dist < best_dist )
+        {
+            best = entry;
+            best_dist = dist;
+        }
+    }
+    return best && best_dist <= 1 ? best->leaf_size : default_leaf_size( dtype, m, n, k );
+}
+
+/*
+ * The file has one entry per line:
+ *     <type> <smallest n> <largest n> <workers> <leaf size>
+ * Blank lines and lines starting with '#' are ignored.
+ */
+int mm_load_tuning(const char *path)
+{
+    FILE *file = fopen( path, "r" );
+    if( !file ) return -1;
+
+    char line[256];
+    int loaded = 0;
+    while( fgets( line, sizeof(line), file ) )
+    {
+        char name[32];
+        int lo, hi, workers, leaf_size;
+        if( line[0] == '#' ) continue;
+        if( sscanf( line, "%31s %d %d %d %d", name, &lo, &hi, &workers, &leaf_size ) != 5 ) continue;
+        if( leaf_size <= 0 || lo <= 0 ) continue;
+
+        for( int d = 0; d < (int)( sizeof(dtype_names) / sizeof(dtype_names[0]) ); d++ )
+        {
+            if( strcmp( name, dtype_names[d] ) ) continue;
+            set_entry( (mm_dtype) d, size_class( lo ), workers, leaf_size );
+            loaded++;
+        }
+    }
+    fclose( file );
+    return loaded;
+}
+
+static int save_tuning(const char *path)
+{
+    FILE *file = fopen( path, "w" );
+    if( !file ) return -1;
+
+    fprintf( file, "# leaf sizes tuned by mm_autotune\n" );
+    fprintf( file, "# type smallest_n largest_n workers leaf_size\n" );
+    for( int i = 0; i < tune_count; i++ )
+    {
+        const tune_entry *entry = &tune_table[i];
+        fprintf( file, "%s %d %d %d %d\n", mm_dtype_name( entry->dtype ), 1 << entry->size_class,
+                 ( 2 << entry->size_class ) - 1, entry->workers, entry->leaf_size );
+    }
+    fclose( file );
+    return 0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/*
+ * Best of TUNE_REPS multiplies of two n x n matrices at each candidate leaf
+ * size.  Packing is outside the timed region since it is the same work at
+ * every size.
+ */
+template <typename T>
+static int tune_leaf_size(int n)
+{
+    typedef typename mm_types<T>::acc acc_t;
+
+    mm_options saved, options;
+    mm_get_options( &saved );
+    options = saved;
+
+    T *A = (T *) malloc( (size_t)n * n * sizeof(T) );
+    T *B = (T *) malloc( (size_t)n * n * sizeof(T) );
+    if( !A || !B )
+    {
+        free( A );
+        free( B );
+        return -1;
+    }
+    for( size_t i = 0; i < (size_t)n * n; i++ )
+    {
+        A[i] = T( (int)( i * 7 % 13 ) - 6 );
+        B[i] = T( (int)( i * 5 % 11 ) - 5 );
+    }
+
+    int best_leaf = -1;
+    double best_time = 0.0;
+    for( int c = 0; leaf_candidates[c]; c++ )
+    {
+        int leaf_size = leaf_candidates[c];
+        if( leaf_size > n && c > 0 ) break;
+
+        options.leaf_size = leaf_size;
+        mm_set_options( &options );
+
+        T *a_morton = (T *) malloc( mm_morton_size( n, n ) * sizeof(T) );
+        T *b_morton = (T *) malloc( mm_morton_size( n, n ) * sizeof(T) );
+        acc_t *c_morton = (acc_t *) malloc( mm_morton_size( n, n ) * sizeof(acc_t) );
+        if( a_morton && b_morton && c_morton )
+        {
+            mm_pack_a( 'N', n, n, A, n, a_morton );
+            mm_pack_b( 'N', n, n, B, n, b_morton );
+
+            // the first run warms caches and the workspace pool
+            double fastest = 0.0;
+            for( int rep = 0; rep <= TUNE_REPS; rep++ )
+            {
+                mm_zero( c_morton, mm_morton_size( n, n ) );
+                double start = now_sec();
+                mm_multiply( n, n, n, a_morton, b_morton, c_morton );
+                double elapsed = now_sec() - start;
+                if( rep == 1 || ( rep > 1 && elapsed < fastest ) ) fastest = elapsed;
+            }
+
+            if( best_leaf < 0 || fastest < best_time )
+            {
+                best_leaf = leaf_size;
+                best_time = fastest;
+            }
+        }
+        free( a_morton );
+        free( b_morton );
+        free( c_morton );
+    }
+
+    mm_set_options( &saved );
+    free( A );
+    free( B );
+    return best_leaf;
+}
+
+int mm_autotune(mm_dtype dtype, int n, const char *path)
+{
+    int leaf_size;
+
+    if( n <= 0 ) return -1;
+    switch( dtype )
+    {
+    case MM_FLOAT32:    leaf_size = tune_leaf_size<float>( n ); break;
+    case MM_FLOAT64:    leaf_size = tune_leaf_size<double>( n ); break;
+    case MM_INT8:       leaf_size = tune_leaf_size<int8_t>( n ); break;
+    case MM_COMPLEX64:  leaf_size = tune_leaf_size< std::complex<float> >( n ); break;
+    case MM_COMPLEX128: leaf_size = tune_leaf_size< std::complex<double> >( n ); break;
+    default:            return -1;
+    }
+    if( leaf_size < 0 ) return -1;
+
+    // merge with what earlier runs saved before rewriting the file
+    if( path ) mm_load_tuning( path );
+    set_entry( dtype, size_class( n ), mm_get_workers(), leaf_size );
+    if( path && save_tuning( path ) ) return -1;
+    return leaf_size;
+}
@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdlib.h>
+#include <math.h>
+#include <complex>
+#include <atomic>
+
+#include "mm_dac.h"
+#include "mm_parallel.h"
+
+// multiplies checked exactly by MM_VERIFY_AUTO, about 512^3
+#define EXACT_AUTO_LIMIT ((double) (1 << 27))
+
+// rows and k-extent of one block of the exact reference
+#define EXACT_ROWS 32
+#define EXACT_DEPTH 256
+
+/*
+ * Checks run in a wider type than the accumulator: double for the real
+ * types, complex<double> for the complex ones and int64 for int32, whose
+ * row sums would otherwise overflow.
+ */
+template <typename U> struct check_type { typedef double type; };
+template <> struct check_type<int32_t> { typedef int64_t type; };
+template <> struct check_type< std::complex<float> > { typedef std::complex<double> type; };
+template <> struct check_type< std::complex<double> > { typedef std::complex<double> type; };
+
+// default relative tolerance against sum |a| |b| for each accumulator type
+template <typename U> static double default_rtol(void) { return 1.0E-10; }
+template <> double default_rtol<float>(void) { return 1.0E-5; }
+template <> double default_rtol< std::complex<float> >(void) { return 1.0E-5; }
+template <> double default_rtol<int32_t>(void) { return 0.0; }
+
+static inline double magnitude(double x) { return fabs( x ); }
+static inline double magnitude(int64_t x) { return (double) ( x < 0 ? -x : x ); }
+static inline double magnitude(const std::complex<double> &x) { return std::abs( x ); }
+
+/*
+ * Mixed tolerance: computed and reference agree when they differ by at
+ * most atol + rtol * scale, where scale bounds the magnitude of the terms
+ * that were summed, so a result that cancels to near zero is not held to a
+ * relative error it cannot meet.
+ */
+template <typename V>
+static inline int within(const V &computed, const V &reference, double scale, double rtol, double atol)
+{
+    return magnitude( computed - reference ) <= atol + rtol * scale;
+}
+
+// +1 or -1 for entry j of trial t, a pure function of its arguments
+static inline int random_sign(unsigned long long seed, int trial, int j)
+{
+    unsigned long long x = seed + 0x9E3779B97F4A7C15ULL * ( ( (unsigned long long) trial << 32 ) + j + 1 );
+    x = ( x ^ ( x >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    x = ( x ^ ( x >> 27 ) ) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return ( x & 1 ) ? 1 : -1;
+}
+
+/*
+ * Freivalds: with r a random +-1 vector, C r == A (B r) for a correct C,
+ * while a wrong C passes one trial with probability at most 1/2.  Each
+ * trial is three parallel matrix-vector products, O(mk + kn + mn).  The
+ * same products over |A|, |B| and |r| = 1 give the summed scale of the n
+ * elements of a row of C; their rounding errors enter with random signs and
+ * add up like a random walk, so the row is held to that scale / sqrt(n).
+ */
+template <typename T>
+static int check_freivalds(int m, int n, int k, const T *A, int lda, const T *B, int ldb,
+                           const typename mm_types<T>::acc *C, int ldc, int trials, double rtol, double atol)
+{
+    typedef typename check_type<typename mm_types<T>::acc>::type chk_t;
+
+    chk_t *y = (chk_t *) malloc( (size_t) k * sizeof(chk_t) );
+    double *y_scale = (double *) malloc( (size_t) k * sizeof(double) );
+    int *r = (int *) malloc( (size_t) n * sizeof(int) );
+    if( !y || !y_scale || !r )
+    {
+        free( y );
+        free( y_scale );
+        free( r );
+        return -1;
+    }
+
+    const double walk = 1.0 / sqrt( (double) n );
+    int wrong = 0;
+    for( int trial = 0; trial < trials && !wrong; trial++ )
+    {
+        mm_parallel_for( 0, n, [&]( int j ) {
+            r[j] = random_sign( 12345, trial, j );
+        } );
+
+        // y = B r
+        mm_parallel_for( 0, k, [&]( int l ) {
+            const T *row = B + (size_t) l * ldb;
+            chk_t sum = chk_t();
+            double scale = 0.0;
+            for( int j = 0; j < n; j++ )
+            {
+                chk_t b = chk_t( row[j] );
+                sum += r[j] > 0 ? b : -b;
+                scale += magnitude( b );
+            }
+            y[l] = sum;
+            y_scale[l] = scale;
+        } );
+
+        // compare A y with C r row by row
+        std::atomic<int> row_wrong( 0 );
+        mm_parallel_for( 0, m, [&]( int i ) {
+            const T *a_row = A + (size_t) i * lda;
+            const typename mm_types<T>::acc *c_row = C + (size_t) i * ldc;
+            chk_t ay = chk_t(), cr = chk_t();
+            double scale = 0.0;
+            for( int l = 0; l < k; l++ )
+            {
+                chk_t a = chk_t( a_row[l] );
+                ay += a * y[l];
+                scale += magnitude( a ) * y_scale[l];
+            }
+            for( int j = 0; j < n; j++ )
+            {
+                chk_t c = chk_t( c_row[j] );
+                cr += r[j] > 0 ? c : -c;
+            }
+            if( !within( cr, ay, scale * walk, rtol, atol ) ) row_wrong.store( 1, std::memory_order_relaxed );
+        } );
+        wrong = row_wrong.load();
+    }
+
+    free( y );
+    free( y_scale );
+    free( r );
+    return wrong;
+}
+
+// lowers first to index unless it already holds a smaller one
+static void record_first(std::atomic<size_t> &first, size_t index)
+{
+    size_t seen = first.load( std::memory_order_relaxed );
+    while( index < seen && !first.compare_exchange_weak( seen, index, std::memory_order_relaxed ) ) {}
+}
+
+/*
+ * Exact reference: every element of A B recomputed in the check type, in
+ * parallel blocks of EXACT_ROWS rows that stream EXACT_DEPTH rows of B at
+ * a time, together with sum |a| |b| for the tolerance.  O(mnk), for small
+ * problems or to locate an error Freivalds reported.
+ */
+template <typename T>
+static int check_exact(int m, int n, int k, const T *A, int lda, const T *B, int ldb,
+                       const typename mm_types<T>::acc *C, int ldc, double rtol, double atol)
+{
+    typedef typename check_type<typename mm_types<T>::acc>::type chk_t;
+
+    int blocks = ( m + EXACT_ROWS - 1 ) / EXACT_ROWS;
+    // row-major index of the first wrong element, so the outcome does not
+    // depend on which block finishes first
+    const size_t none = (size_t) -1;
+    std::atomic<size_t> first_wrong( none );
+    std::atomic<int> no_memory( 0 );
+
+    mm_parallel_for( 0, blocks, [&]( int block ) {
+        int row_begin = block * EXACT_ROWS;
+        int rows = m - row_begin < EXACT_ROWS ? m - row_begin : EXACT_ROWS;
+        //an earlier block already failed
+        if( (size_t) row_begin * n > first_wrong.load( std::memory_order_relaxed ) ) return;
+        chk_t *ref = (chk_t *) malloc( (size_t) rows * n * sizeof(chk_t) );
+        double *scale = (double *) calloc( (size_t) rows * n, sizeof(double) );
+        if( !ref || !scale )
+        {
+            no_memory.store( 1, std::memory_order_relaxed );
+        }
+        else
+        {
+            for( size_t e = 0; e < (size_t) rows * n; e++ ) ref[e] = chk_t();
+
+            for( int l0 = 0; l0 < k; l0 += EXACT_DEPTH )
+            {
+                int l_end = k - l0 < EXACT_DEPTH ? k : l0 + EXACT_DEPTH;
+                for( int i = 0; i < rows; i++ )
+                {
+                    const T *a_row = A + (size_t) ( row_begin + i ) * lda;
+                    chk_t *ref_row = ref + (size_t) i * n;
+                    double *scale_row = scale + (size_t) i * n;
+                    for( int l = l0; l < l_end; l++ )
+                    {
+                        chk_t a = chk_t( a_row[l] );
+                        double a_mag = magnitude( a );
+                        const T *b_row = B + (size_t) l * ldb;
+                        for( int j = 0; j < n; j++ )
+                        {
+                            chk_t b = chk_t( b_row[j] );
+                            ref_row[j] += a * b;
+                            scale_row[j] += a_mag * magnitude( b );
+                        }
+                    }
+                }
+            }
+
+            int found = 0;
+            for( int i = 0; i < rows && !found; i++ )
+            {
+                const typename mm_types<T>::acc *c_row = C + (size_t) ( row_begin + i ) * ldc;
+                for( int j = 0; j < n; j++ )
+                {
+                    if( !within( chk_t( c_row[j] ), ref[(size_t) i * n + j], scale[(size_t) i * n + j],
+                                 rtol, atol ) )
+                    {
+                        record_first( first_wrong, (size_t) ( row_begin + i ) * n + j );
+                        found = 1;
+                        break;
+                    }
+                }
+            }
+        }
+        free( ref );
+        free( scale );
+    } );
+    if( no_memory.load() ) return -1;
+    return first_wrong.load() != none;
+}
+
+template <typename T>
+int mm_verify(int mode, int m, int n, int k, const T *A, int lda, const T *B, int ldb,
+              const typename mm_types<T>::acc *C, int ldc, int trials, double rtol, double atol)
+{
+    if( m < 0 || n < 0 || k < 0 || lda < ( k > 1 ? k : 1 ) || ldb < ( n > 1 ? n : 1 ) ||
+        ldc < ( n > 1 ? n : 1 ) )
+        return -1;
+    if( m == 0 || n == 0 ) return 0;
+
+    if( rtol < 0.0 ) rtol = default_rtol<typename mm_types<T>::acc>();
+    if( atol < 0.0 ) atol = 0.0;
+    if( trials <= 0 ) trials = MM_VERIFY_TRIALS;
+
+    if( mode == MM_VERIFY_AUTO )
+        mode = (double) m * n * k <= EXACT_AUTO_LIMIT ? MM_VERIFY_EXACT : MM_VERIFY_FREIVALDS;
+    if( mode == MM_VERIFY_EXACT )
+        return check_exact( m, n, k, A, lda, B, ldb, C, ldc, rtol, atol );
+    return check_freivalds( m, n, k, A, lda, B, ldb, C, ldc, trials, rtol, atol );
+}
+
+#define MM_INSTANTIATE_VERIFY(T) \
+    template int mm_verify<T>(int, int, int, int, const T *, int, const T *, int, \
+                              const mm_types<T>::acc *, int, int, double, double);
+
+MM_INSTANTIATE_VERIFY(float)
+MM_INSTANTIATE_VERIFY(double)
+MM_INSTANTIATE_VERIFY(int8_t)
+MM_INSTANTIATE_VERIFY(std::complex<float>)
+MM_INSTANTIATE_VERIFY(std::complex<double>)
@@ -0,0 +1,227 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mm_dac.h"
+#include "mm_parallel.h"
+#include "mm_workspace.h"
+
+// huge page size assumed for alignment and explicit huge page mappings
+#define HUGE_PAGE_BYTES ((size_t) 2 << 20)
+
+/*
+ * The arena hands out whole mappings, so every buffer is page aligned (and
+ * huge page aligned from HUGE_PAGE_BYTES up), which covers the 64-byte
+ * alignment the SIMD kernels want.  Released blocks stay mapped for reuse.
+ */
+typedef struct workspace_block {
+    void *buffer;
+    size_t bytes;       // usable size
+    void *map;          // the whole mapping, which may start before buffer
+    size_t mapped;
+    int in_use;
+    struct workspace_block *next;
+} workspace_block;
+
+static pthread_mutex_t workspace_lock = PTHREAD_MUTEX_INITIALIZER;
+static workspace_block *workspace_blocks = 0;
+
+static size_t page_bytes(void)
+{
+    long page = sysconf( _SC_PAGESIZE );
+    return page > 0 ? (size_t) page : 4096;
+}
+
+static size_t round_up(size_t bytes, size_t unit)
+{
+    return ( bytes + unit - 1 ) / unit * unit;
+}
+
+/*
+ * Map a new block.  Explicit huge pages need a reserved hugetlbfs pool and
+ * fall back to transparent ones; those need the block huge page aligned,
+ * so it is cut out of a mapping one huge page larger.
+ */
+static int map_block(workspace_block *block, size_t bytes, int huge_pages)
+{
+    if( huge_pages == MM_HUGE_PAGES_EXPLICIT && bytes >= HUGE_PAGE_BYTES )
+    {
+        size_t mapped = round_up( bytes, HUGE_PAGE_BYTES );
+        void *map = mmap( 0, mapped, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if( map != MAP_FAILED )
+        {
+            block->buffer = block->map = map;
+            block->bytes = block->mapped = mapped;
+            return 1;
+        }
+    }
+
+    if( huge_pages != MM_HUGE_PAGES_NONE && bytes >= HUGE_PAGE_BYTES )
+    {
+        size_t usable = round_up( bytes, HUGE_PAGE_BYTES );
+        size_t mapped = usable + HUGE_PAGE_BYTES;
+        char *map = (char *) mmap( 0, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( map == MAP_FAILED ) return 0;
+
+        char *buffer = (char *) round_up( (size_t) map, HUGE_PAGE_BYTES );
+        block->buffer = buffer;
+        block->bytes = usable;
+        block->map = map;
+        block->mapped = mapped;
+#ifdef MADV_HUGEPAGE
+        madvise( buffer, usable, MADV_HUGEPAGE );
+#endif
+        return 1;
+    }
+
+    size_t mapped = round_up( bytes > 0 ? bytes : 1, page_bytes() );
+    void *map = mmap( 0, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( map == MAP_FAILED ) return 0;
+    block->buffer = block->map = map;
+    block->bytes = block->mapped = mapped;
+    return 1;
+}
+
+void mm_workspace_prefault(void *buffer, size_t bytes)
+{
+    char *base = (char *) buffer;
+    const size_t page = page_bytes();
+
+    // one write per page, spread over the workers so first-touch placement
+    // follows the parallel recursion rather than the calling thread
+    mm_parallel_for_range( 0, bytes, 64 * page, [&]( size_t offset, size_t end ) {
+        for( size_t p = offset; p < end; p += page )
+            ( (volatile char *) base )[p] = 0;
+    } );
+}
+
+void *mm_workspace_acquire(size_t bytes, int *fresh)
+{
+    workspace_block *best = 0;
+    workspace_block *small = 0;
+    int prefault = 0;
+    mm_options options;
+
+    mm_get_options( &options );
+    if( fresh ) *fresh = 0;
+
+    pthread_mutex_lock( &workspace_lock );
+
+    // smallest idle block that fits without wasting more than its request
+    for( workspace_block *block = workspace_blocks; block; block = block->next )
+    {
+        if( block->in_use ) continue;
+        if( block->bytes >= bytes && block->bytes <= 2 * bytes + page_bytes() &&
+            ( !best || block->bytes < best->bytes ) )
+            best = block;
+        if( block->bytes < bytes ) small = block;
+    }
+
+    if( !best )
+    {
+        // replace an idle block that is too small rather than growing the pool
+        if( small )
+        {
+            if( small->map ) munmap( small->map, small->mapped );
+            best = small;
+        }
+        else
+        {
+            best = (workspace_block *) malloc( sizeof(workspace_block) );
+            if( best )
+            {
+                best->next = workspace_blocks;
+                workspace_blocks = best;
+            }
+        }
+
+        if( best && !map_block( best, bytes, options.huge_pages ) )
+        {
+            // keep the list consistent; an unmapped entry just holds nothing
+            best->buffer = best->map = 0;
+            best->bytes = best->mapped = 0;
+            best = 0;
+        }
+        else if( best )
+        {
+            // a caller that places the pages itself prefaults after placing them
+            if( fresh ) *fresh = 1;
+            else prefault = options.prefault;
+        }
+    }
+
+    if( best ) best->in_use = 1;
+    pthread_mutex_unlock( &workspace_lock );
+
+    if( prefault ) mm_workspace_prefault( best->buffer, best->bytes );
+    return best ? best->buffer : 0;
+}
+
+void mm_workspace_release(void *buffer)
+{
+    if( !buffer ) return;
+
+    pthread_mutex_lock( &workspace_lock );
+    for( workspace_block *block = workspace_blocks; block; block = block->next )
+    {
+        if( block->buffer == buffer )
+        {
+            block->in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &workspace_lock );
+}
+
+void *mm_alloc(size_t bytes)
+{
+    return mm_workspace_acquire( bytes, 0 );
+}
+
+void mm_free(void *buffer)
+{
+    mm_workspace_release( buffer );
+}
+
+void mm_free_workspace(void)
+{
+    pthread_mutex_lock( &workspace_lock );
+    workspace_block **link = &workspace_blocks;
+    while( *link )
+    {
+        workspace_block *block = *link;
+        if( block->in_use )
+        {
+            link = &block->next;
+            continue;
+        }
+        *link = block->next;
+        if( block->map ) munmap( block->map, block->mapped );
+        free( block );
+    }
+    pthread_mutex_unlock( &workspace_lock );
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2018 I-Ting Angelina Lee  
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _MM_WORKSPACE_H_
+#define _MM_WORKSPACE_H_
+
+#include <stddef.h>
+
+/*
+ * Process-wide arena of page-aligned buffers, backed by huge pages as
+ * mm_options.huge_pages allows, for the recursion's temporaries and the
+ * engine's Morton buffers.  A buffer is held from acquire to release and
+ * handed to the next caller that needs about its size, so steady-state
+ * calls neither allocate nor fault.  Returns 0 if no buffer could be mapped.
+ *
+ * New mappings are prefaulted when mm_options.prefault is set, unless the
+ * caller passes fresh: then *fresh tells whether the buffer is a new,
+ * untouched mapping, and the caller places and prefaults it itself.
+ */
+void *mm_workspace_acquire(size_t bytes, int *fresh);
+void mm_workspace_release(void *buffer);
+
+// touch every page of buffer from parallel workers
+void mm_workspace_prefault(void *buffer, size_t bytes);
+
+#endif  // _MM_WORKSPACE_H_